@@ -0,0 +1,311 @@
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "arithmetic.hpp"
+#include "biguint.hpp"
+#include "encryption.hpp"
+#include "decryption.hpp"
+#include "keys.hpp"
+#include "output.hpp"
+#include "hex.hpp"
+#include "container.hpp"
+#include "thread_pool.hpp"
+
+// Benchmarks of the building blocks of the program. The results are printed
+// out as JSON, one object per operation, type of the numbers, key length
+// and input size. For the operations that don't work with blocks (mult,
+// getInvertedP, ...), a block is a single value they process.
+
+#define TABLE_LIMIT (16 * 1024 * 1024)
+#define VALUE_COUNT 4096
+
+// All the allocations go through here, so they can be counted per operation.
+// GCC takes the free() of the replaced operator delete for a mismatch when
+// it inlines it into a call site of the standard operator new.
+static std::atomic<size_t> allocations{0};
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+void *operator new(size_t size) {
+    allocations++;
+    if (void *p = std::malloc(size != 0 ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    std::free(p);
+}
+#pragma GCC diagnostic pop
+
+struct result_t {
+    std::string operation;
+    std::string type;
+    size_t keyLength;
+    size_t inputBytes;
+    size_t blocks;      // per operation
+    size_t iterations;
+    double seconds;     // all the iterations
+    size_t allocations; // all the iterations
+};
+
+double minSeconds = 0.2;
+std::vector<result_t> results;
+
+template<typename T> const char *typeName();
+template<> const char *typeName<uint32_t>() { return "uint32_t"; }
+template<> const char *typeName<uint64_t>() { return "uint64_t"; }
+template<> const char *typeName<uint128_t>() { return "uint128_t"; }
+template<> const char *typeName<BigUInt<4>>() { return "BigUInt<4>"; }
+template<> const char *typeName<BigUInt<8>>() { return "BigUInt<8>"; }
+template<> const char *typeName<BigUInt<16>>() { return "BigUInt<16>"; }
+
+// Runs the operation once to warm up, then as many times as it takes minSeconds.
+template<typename F>
+void measure(const std::string &operation, const std::string &type, size_t keyLength, size_t inputBytes, size_t blocks, F run) {
+    run();
+    size_t iterations = 0;
+    size_t allocationsBefore = allocations;
+    auto start = std::chrono::steady_clock::now();
+    double seconds;
+    do {
+        run();
+        iterations++;
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } while (seconds < minSeconds);
+    results.push_back({operation, type, keyLength, inputBytes, blocks, iterations, seconds, allocations - allocationsBefore});
+}
+
+template<typename T>
+T randomNumber(std::mt19937_64 &rng, const T &limit) {
+    T value = 0;
+    for (size_t i = 0; i < sizeof(T) / sizeof(uint32_t); i++)
+        value = (value << 16 << 16) | T((uint32_t)rng());
+    return value % limit;
+}
+
+template<typename T>
+struct bench_key_t {
+    std::vector<T> privateKey;
+    std::vector<T> publicKey;
+    T p, q, invertedP;
+};
+
+// A super-increasing key of n values (each of them about as large as the
+// sum of the previous ones, so q is about 2^(n+1)) and p relatively prime to q.
+template<typename T>
+bench_key_t<T> makeKey(std::mt19937_64 &rng, size_t n) {
+    bench_key_t<T> key;
+    T sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        key.privateKey.push_back(sum + T(1 + rng() % 4));
+        sum += key.privateKey.back();
+    }
+    key.q = sum + T(1 + rng() % 4);
+    key.p = randomNumber(rng, key.q);
+    while (true) {
+        key.invertedP = getInvertedP(key.p, key.q);
+        if (mult(key.p, key.invertedP, key.q) == T(1))
+            break;
+        key.p += T(1);
+    }
+    key.publicKey = makePublicKey(key.privateKey, key.p, key.q);
+    return key;
+}
+
+template<typename T>
+void benchArithmetic(std::mt19937_64 &rng, const bench_key_t<T> &key) {
+    const char *type = typeName<T>();
+    size_t n = key.privateKey.size();
+    std::vector<T> a(VALUE_COUNT), b(VALUE_COUNT), out(VALUE_COUNT);
+    for (size_t i = 0; i < VALUE_COUNT; i++) {
+        a[i] = randomNumber(rng, key.q);
+        b[i] = randomNumber(rng, key.q);
+    }
+    auto multiplier = makeShoupMultiplier(key.invertedP, key.q);
+
+    measure("mult", type, n, 0, VALUE_COUNT, [&]() {
+        for (size_t i = 0; i < VALUE_COUNT; i++)
+            out[i] = mult(a[i], b[i], key.q);
+    });
+    measure("multShoup", type, n, 0, VALUE_COUNT, [&]() {
+        for (size_t i = 0; i < VALUE_COUNT; i++)
+            out[i] = mult(multiplier, a[i]);
+    });
+    measure("multBatch", type, n, 0, VALUE_COUNT, [&]() {
+        mult(multiplier, a.data(), VALUE_COUNT, out.data());
+    });
+    measure("getInvertedP", type, n, 0, 1, [&]() {
+        out[0] = getInvertedP(key.p, key.q);
+    });
+    measure("makePublicKey", type, n, 0, n, [&]() {
+        auto publicKey = makePublicKey(key.privateKey, key.p, key.q);
+        out[0] = publicKey[0];
+    });
+
+    std::ostringstream keyFile;
+    for (size_t i = 0; i < n; i++)
+        keyFile << widenNumber(key.privateKey[i]) << (i + 1 < n ? ", " : "\n");
+    std::string keyFileContent = keyFile.str();
+    measure("parseKey", type, n, keyFileContent.size(), n, [&]() {
+        std::vector<widest_t> parsed;
+        parseKey(keyFileContent, parsed);
+    });
+}
+
+template<typename T>
+void benchData(std::mt19937_64 &rng, const bench_key_t<T> &key, size_t size) {
+    const char *type = typeName<T>();
+    size_t n = key.privateKey.size();
+    std::vector<uint8_t> input(size);
+    for (auto &byte : input)
+        byte = rng();
+
+    auto table = buildEncryptionTable(key.publicKey, TABLE_LIMIT);
+    std::vector<T> blocks;
+    measure(table.sums.empty() ? "encryptByKernel" : "encryptByTable", type, n, size, (size * 8 + n - 1) / n, [&]() {
+        blocks.clear();
+        encryptBytes(table, input.data(), size, blocks);
+    });
+
+    auto multiplier = makeShoupMultiplier(key.invertedP, key.q);
+    std::vector<uint8_t> decrypted((blocks.size() * n + 7) / 8);
+    auto decrypt = [&](const std::string &operation, decomposition_t mode) {
+        auto index = buildKeyIndex(key.privateKey, mode);
+        measure(operation, type, n, size, blocks.size(), [&]() {
+            std::memset(decrypted.data(), 0, decrypted.size());
+            decryptBlocks(key.privateKey, index, blocks.data(), blocks.size(), multiplier, decrypted.data());
+        });
+    };
+    decrypt("decryptLinear", DECOMPOSITION_LINEAR);
+    decrypt("decryptJump", DECOMPOSITION_JUMP);
+    decrypt("decryptAuto", DECOMPOSITION_AUTO);
+    if (fitsDecodeTable(n, key.q, TABLE_LIMIT)) {
+        ThreadPool pool(1);
+        auto decodeTable = buildDecodeTable(key.privateKey, key.q, pool);
+        measure("decryptByTable", type, n, size, blocks.size(), [&]() {
+            std::memset(decrypted.data(), 0, decrypted.size());
+            decryptBlocks(decodeTable, blocks.data(), blocks.size(), multiplier, decrypted.data());
+        });
+    }
+    if (std::memcmp(decrypted.data(), input.data(), size) != 0)
+        std::cerr << "the data decrypted using a key of " << n << " values doesn't match the input!\n";
+
+    // the blocks as the little-endian numbers the program writes out, which
+    // go into /dev/null so that only the formatting is measured
+    std::vector<uint8_t> blockBytes(blocks.size() * sizeof(T));
+    for (size_t i = 0; i < blocks.size(); i++)
+        storeLittleEndian(&blockBytes[i * sizeof(T)], blocks[i], sizeof(T));
+    int null = open("/dev/null", O_WRONLY);
+    measure("writeHex", type, n, size, blocks.size(), [&]() {
+        OutputWriter writer(null);
+        writer.writeBlocks(blockBytes.data(), blocks.size(), sizeof(T), 5);
+    });
+    measure("writeText", type, n, size, blocks.size(), [&]() {
+        OutputWriter writer(null);
+        writer.writeData(input.data(), size, false, 5);
+    });
+    close(null);
+
+    std::string hex;
+    char number[MAX_HEX_LENGTH];
+    for (size_t i = 0; i < blocks.size(); i++)
+        hex.append(number, formatHex(number, &blockBytes[i * sizeof(T)], sizeof(T), 5));
+    std::vector<uint8_t> parsed;
+    size_t parsedCount = 0;
+    measure("parseHex", type, n, size, blocks.size(), [&]() {
+        parseHex(hex.data(), hex.size(), sizeof(T), parsed, parsedCount);
+    });
+    if (parsed != blockBytes)
+        std::cerr << "the hex data parsed using a key of " << n << " values doesn't match the blocks!\n";
+}
+
+// The decomposition of data with only some of the bits set, which is where
+// jumping between the values of the key pays off (see buildKeyIndex()).
+template<typename T>
+void benchDecomposition(std::mt19937_64 &rng, const bench_key_t<T> &key, size_t size) {
+    const char *type = typeName<T>();
+    size_t n = key.privateKey.size();
+    auto table = buildEncryptionTable(key.publicKey, TABLE_LIMIT);
+    auto multiplier = makeShoupMultiplier(key.invertedP, key.q);
+    for (int percent : {1, 3, 10, 20, 30, 40}) {
+        std::vector<uint8_t> input(size, 0);
+        for (size_t i = 0; i < size * 8; i++)
+            if ((int)(rng() % 100) < percent)
+                input[i / 8] |= 0x80 >> (i % 8);
+        std::vector<T> blocks;
+        encryptBytes(table, input.data(), size, blocks);
+        // an empty last block is dropped, which leaves out the zero bytes it stands for
+        std::vector<uint8_t> decrypted(std::max((blocks.size() * n + 7) / 8, size));
+        std::string bitsSet = " (" + std::to_string(percent) + "% bits set)";
+        for (auto mode : {DECOMPOSITION_LINEAR, DECOMPOSITION_JUMP}) {
+            auto index = buildKeyIndex(key.privateKey, mode);
+            std::string operation = mode == DECOMPOSITION_LINEAR ? "decryptLinear" : "decryptJump";
+            measure(operation + bitsSet, type, n, size, blocks.size(), [&]() {
+                std::memset(decrypted.data(), 0, decrypted.size());
+                decryptBlocks(key.privateKey, index, blocks.data(), blocks.size(), multiplier, decrypted.data());
+            });
+        }
+        if (std::memcmp(decrypted.data(), input.data(), size) != 0)
+            std::cerr << "the sparse data decrypted using a key of " << n << " values doesn't match the input!\n";
+    }
+}
+
+template<typename T>
+void bench(size_t keyLength, const std::vector<size_t> &sizes) {
+    std::mt19937_64 rng(keyLength);
+    auto key = makeKey<T>(rng, keyLength);
+    benchArithmetic(rng, key);
+    for (size_t size : sizes)
+        benchData(rng, key, size);
+    benchDecomposition(rng, key, sizes.front());
+}
+
+void printResults() {
+    std::cout << "{\n  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const result_t &r = results[i];
+        double seconds = r.seconds / r.iterations;
+        std::cout << "    {\"operation\": \"" << r.operation << "\", \"type\": \"" << r.type
+                  << "\", \"keyLength\": " << r.keyLength << ", \"inputBytes\": " << r.inputBytes
+                  << ", \"blocks\": " << r.blocks << ", \"iterations\": " << r.iterations
+                  << ", \"nsPerBlock\": " << seconds * 1e9 / r.blocks
+                  << ", \"mbPerSecond\": " << (r.inputBytes != 0 ? r.inputBytes / seconds / 1e6 : 0)
+                  << ", \"allocationsPerOp\": " << (double)r.allocations / r.iterations << "}"
+                  << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    std::cout << "  ]\n}\n";
+}
+
+// ./benchmark [min seconds per benchmark]
+int main(int argc, char *argv[]) {
+    if (argc > 1)
+        minSeconds = std::atof(argv[1]);
+
+    const std::vector<size_t> sizes = {64 * 1024, 1024 * 1024};
+    bench<uint32_t>(8, sizes);
+    bench<uint32_t>(24, sizes);
+    bench<uint64_t>(45, sizes);
+    bench<uint128_t>(100, sizes);
+    bench<BigUInt<4>>(200, sizes);
+    bench<BigUInt<8>>(400, sizes);
+    bench<BigUInt<16>>(900, sizes);
+    printResults();
+    return 0;
+}
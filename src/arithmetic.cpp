@@ -0,0 +1,120 @@
+#include "arithmetic.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define X86_SIMD
+#endif
+
+uint128_t mulHigh(uint128_t a, uint128_t b) {
+    uint64_t aLow = a, aHigh = a >> 64;
+    uint64_t bLow = b, bHigh = b >> 64;
+
+    uint128_t low = (uint128_t)aLow * bLow;
+    uint128_t middle1 = (uint128_t)aHigh * bLow;
+    uint128_t middle2 = (uint128_t)aLow * bHigh;
+    uint128_t high = (uint128_t)aHigh * bHigh;
+
+    uint128_t carry = ((low >> 64) + (uint64_t)middle1 + (uint64_t)middle2) >> 64;
+    return high + (middle1 >> 64) + (middle2 >> 64) + carry;
+}
+
+uint128_t mult(uint128_t a, uint128_t b, uint128_t c) {
+    // c < 2^127, so doubling a value less than c never overflows
+    a %= c;
+    uint128_t result = 0;
+    while (b != 0) {
+        if (b & 1) {
+            result += a;
+            if (result >= c)
+                result -= c;
+        }
+        a += a;
+        if (a >= c)
+            a -= c;
+        b >>= 1;
+    }
+    return result;
+}
+
+typedef void (*mult_kernel_t)(const shoup_multiplier_t<uint32_t> &, const uint32_t *, size_t, uint32_t *);
+
+static void multScalar(const shoup_multiplier_t<uint32_t> &m, const uint32_t *x, size_t count, uint32_t *out) {
+    for (size_t i = 0; i < count; i++)
+        out[i] = mult(m, x[i]);
+}
+
+#ifdef X86_SIMD
+// The same as mult(m, x) in each lane. mul_epu32 multiplies only the even
+// 32-bit lanes (into 64 bits), so the odd ones are shifted down and multiplied
+// separately; the upper halves of both make up the quotient. r < 2q, and if
+// r < q, r - q wraps around, so min(r, r - q) is the reduced value.
+__attribute__((target("avx2")))
+static void multAvx2(const shoup_multiplier_t<uint32_t> &m, const uint32_t *x, size_t count, uint32_t *out) {
+    __m256i w = _mm256_set1_epi32(m.w), wq = _mm256_set1_epi32(m.wq), q = _mm256_set1_epi32(m.q);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(x + i));
+        __m256i even = _mm256_srli_epi64(_mm256_mul_epu32(v, wq), 32);
+        __m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(v, 32), wq);
+        __m256i quotient = _mm256_blend_epi32(even, odd, 0xAA);
+        __m256i r = _mm256_sub_epi32(_mm256_mullo_epi32(v, w), _mm256_mullo_epi32(quotient, q));
+        r = _mm256_min_epu32(r, _mm256_sub_epi32(r, q));
+        _mm256_storeu_si256((__m256i *)(out + i), r);
+    }
+    multScalar(m, x + i, count - i, out + i);
+}
+
+// the intrinsics pass _mm512_undefined_epi32() as the unused masked-off source
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+__attribute__((target("avx512f")))
+static void multAvx512(const shoup_multiplier_t<uint32_t> &m, const uint32_t *x, size_t count, uint32_t *out) {
+    __m512i w = _mm512_set1_epi32(m.w), wq = _mm512_set1_epi32(m.wq), q = _mm512_set1_epi32(m.q);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m512i v = _mm512_loadu_si512(x + i);
+        __m512i even = _mm512_srli_epi64(_mm512_mul_epu32(v, wq), 32);
+        __m512i odd = _mm512_mul_epu32(_mm512_srli_epi64(v, 32), wq);
+        __m512i quotient = _mm512_mask_blend_epi32(0xAAAA, even, odd);
+        __m512i r = _mm512_sub_epi32(_mm512_mullo_epi32(v, w), _mm512_mullo_epi32(quotient, q));
+        r = _mm512_min_epu32(r, _mm512_sub_epi32(r, q));
+        _mm512_storeu_si512(out + i, r);
+    }
+    multAvx2(m, x + i, count - i, out + i);
+}
+#pragma GCC diagnostic pop
+#endif
+
+static mult_kernel_t selectMultKernel() {
+#ifdef X86_SIMD
+    if (__builtin_cpu_supports("avx512f"))
+        return multAvx512;
+    if (__builtin_cpu_supports("avx2"))
+        return multAvx2;
+#endif
+    return multScalar;
+}
+
+template<>
+void mult(const shoup_multiplier_t<uint32_t> &m, const uint32_t *x, size_t count, uint32_t *out) {
+    static const mult_kernel_t kernel = selectMultKernel();
+    kernel(m, x, count, out);
+}
+
+std::ostream &operator<<(std::ostream &stream, uint128_t value) {
+    int base = 10;
+    if ((stream.flags() & std::ios::basefield) == std::ios::hex)
+        base = 16;
+    else if ((stream.flags() & std::ios::basefield) == std::ios::oct)
+        base = 8;
+    const char *digits = (stream.flags() & std::ios::uppercase) ? "0123456789ABCDEF" : "0123456789abcdef";
+
+    char buffer[129];
+    char *end = buffer + sizeof(buffer);
+    char *begin = end;
+    do {
+        *--begin = digits[value % base];
+        value /= base;
+    } while (value != 0);
+    return stream << std::string(begin, end);
+}
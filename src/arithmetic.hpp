@@ -0,0 +1,176 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <ostream>
+#include <utility>
+
+__extension__ typedef unsigned __int128 uint128_t;
+
+template<typename T>
+constexpr int bitsOf() {
+    return sizeof(T) * 8;
+}
+
+// The upper half of a * b.
+inline uint32_t mulHigh(uint32_t a, uint32_t b) {
+    return ((uint64_t)a * b) >> 32;
+}
+
+inline uint64_t mulHigh(uint64_t a, uint64_t b) {
+    return ((uint128_t)a * b) >> 64;
+}
+
+uint128_t mulHigh(uint128_t a, uint128_t b);
+
+// The number of bits of the value (0 for 0).
+inline int bitLength(uint32_t a) {
+    return a == 0 ? 0 : 32 - __builtin_clz(a);
+}
+
+inline int bitLength(uint64_t a) {
+    return a == 0 ? 0 : 64 - __builtin_clzll(a);
+}
+
+inline int bitLength(uint128_t a) {
+    uint64_t high = a >> 64;
+    return high != 0 ? 64 + bitLength(high) : bitLength((uint64_t)a);
+}
+
+// The number of trailing zero bits of a nonzero value.
+inline int trailingZeros(uint32_t a) {
+    return __builtin_ctz(a);
+}
+
+inline int trailingZeros(uint64_t a) {
+    return __builtin_ctzll(a);
+}
+
+inline int trailingZeros(uint128_t a) {
+    uint64_t low = a;
+    return low != 0 ? trailingZeros(low) : 64 + trailingZeros((uint64_t)(a >> 64));
+}
+
+// gcd(a, b) using the binary (Stein's) algorithm. It takes only shifts and
+// subtractions, which unlike the division are cheap for BigUInt too.
+template<typename T>
+T binaryGcd(T a, T b) {
+    if (a == T(0))
+        return b;
+    if (b == T(0))
+        return a;
+    int shift = trailingZeros(a | b);
+    a >>= trailingZeros(a);
+    while (b != T(0)) {
+        b >>= trailingZeros(b);
+        if (a > b)
+            std::swap(a, b);
+        b -= a;
+    }
+    return a << shift;
+}
+
+// (a * b) % c
+inline uint32_t mult(uint32_t a, uint32_t b, uint32_t c) {
+    return (uint64_t)a * b % c;
+}
+
+inline uint64_t mult(uint64_t a, uint64_t b, uint64_t c) {
+    return (uint128_t)a * b % c;
+}
+
+uint128_t mult(uint128_t a, uint128_t b, uint128_t c);
+
+// Multiplication by a fixed w modulo a fixed q using Shoup's method.
+// wq = floor(w * 2^bits / q) is computed once, after which every product
+// costs two multiplications and no division. q must be less than 2^(bits-1).
+template<typename T>
+struct shoup_multiplier_t {
+    T w;
+    T wq;
+    T q;
+};
+
+template<typename T>
+shoup_multiplier_t<T> makeShoupMultiplier(T w, T q) {
+    w %= q;
+    T wq = 0;
+    T r = w;
+    for (int i = 0; i < bitsOf<T>(); i++) {
+        r <<= 1;
+        wq <<= 1;
+        if (r >= q) {
+            r -= q;
+            wq |= 1;
+        }
+    }
+    return {w, wq, q};
+}
+
+// (m.w * x) % m.q
+template<typename T>
+inline T mult(const shoup_multiplier_t<T> &m, T x) {
+    T quotient = mulHigh(m.wq, x);
+    T r = m.w * x - quotient * m.q; // r < 2q
+    return r >= m.q ? r - m.q : r;
+}
+
+// out[i] = (m.w * x[i]) % m.q for count values
+template<typename T>
+void mult(const shoup_multiplier_t<T> &m, const T *x, size_t count, T *out) {
+    for (size_t i = 0; i < count; i++)
+        out[i] = mult(m, x[i]);
+}
+
+// Multiplies 16 (AVX-512) or 8 (AVX2) values at a time if the CPU supports it.
+template<>
+void mult(const shoup_multiplier_t<uint32_t> &m, const uint32_t *x, size_t count, uint32_t *out);
+
+// a -= b if b <= a, without branching on the values. Returns 1 if b was subtracted.
+template<typename T>
+inline uint8_t subtractIfNotLess(T &a, const T &b) {
+    uint8_t take = b <= a;
+    a -= b & (T(0) - T(take));
+    return take;
+}
+
+// p^(-1) mod q using the extended Euclidean algorithm. Only the
+// coefficient of p is tracked, and it is kept reduced modulo q.
+template<typename T>
+T getInvertedP(T p, T q) {
+    T r0 = q, r1 = p % q;
+    T t0 = 0, t1 = 1;
+    while (r1 != 0) {
+        T quotient = r0 / r1;
+        T r2 = r0 - quotient * r1;
+        T t2 = (t0 + q - mult(quotient % q, t1, q)) % q;
+        r0 = r1;
+        r1 = r2;
+        t0 = t1;
+        t1 = t2;
+    }
+    return t0;
+}
+
+// Parses a decimal number. Returns false if str is not a number
+// or if the number doesn't fit into T.
+template<typename T>
+bool parseNumber(const std::string &str, T &value) {
+    if (str.empty())
+        return false;
+    value = 0;
+    for (char c : str) {
+        if (c < '0' || c > '9')
+            return false;
+        T digit = c - '0';
+        if (value > (T(~T(0)) - digit) / 10)
+            return false;
+        value = value * 10 + digit;
+    }
+    return true;
+}
+
+// Honors the base, uppercase, width and fill of the stream as the
+// operators for the built-in integer types do.
+std::ostream &operator<<(std::ostream &stream, uint128_t value);
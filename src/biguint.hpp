@@ -0,0 +1,330 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <ostream>
+
+#include "arithmetic.hpp"
+
+// Unsigned integer of a fixed number of 64-bit limbs (little-endian).
+// It behaves as the built-in unsigned types do - all the operations are
+// done modulo 2^(64*N) - so it can be used as the type of the key and
+// the block sums wherever uint32_t, uint64_t or uint128_t would be.
+template<size_t N>
+class BigUInt {
+public:
+    uint64_t limbs[N];
+
+    BigUInt() : limbs{} {
+    }
+
+    BigUInt(uint64_t value) : limbs{} {
+        limbs[0] = value;
+    }
+
+    explicit operator uint64_t() const {
+        return limbs[0];
+    }
+
+    BigUInt &operator+=(const BigUInt &other) {
+        uint64_t carry = 0;
+        for (size_t i = 0; i < N; i++) {
+            uint128_t sum = (uint128_t)limbs[i] + other.limbs[i] + carry;
+            limbs[i] = (uint64_t)sum;
+            carry = sum >> 64;
+        }
+        return *this;
+    }
+
+    BigUInt &operator-=(const BigUInt &other) {
+        uint64_t borrow = 0;
+        for (size_t i = 0; i < N; i++) {
+            uint128_t difference = (uint128_t)limbs[i] - other.limbs[i] - borrow;
+            limbs[i] = (uint64_t)difference;
+            borrow = (difference >> 64) != 0;
+        }
+        return *this;
+    }
+
+    BigUInt &operator*=(const BigUInt &other) {
+        return *this = *this * other;
+    }
+
+    BigUInt &operator/=(const BigUInt &other) {
+        BigUInt remainder;
+        divide(*this, other, *this, remainder);
+        return *this;
+    }
+
+    BigUInt &operator%=(const BigUInt &other) {
+        BigUInt quotient;
+        divide(*this, other, quotient, *this);
+        return *this;
+    }
+
+    BigUInt &operator<<=(int shift) {
+        int limbShift = shift / 64, bitShift = shift % 64;
+        for (int i = N - 1; i >= 0; i--) {
+            uint64_t value = 0;
+            if (i - limbShift >= 0) {
+                value = limbs[i - limbShift] << bitShift;
+                if (bitShift != 0 && i - limbShift - 1 >= 0)
+                    value |= limbs[i - limbShift - 1] >> (64 - bitShift);
+            }
+            limbs[i] = value;
+        }
+        return *this;
+    }
+
+    BigUInt &operator>>=(int shift) {
+        int limbShift = shift / 64, bitShift = shift % 64;
+        for (int i = 0; i < (int)N; i++) {
+            uint64_t value = 0;
+            if (i + limbShift < (int)N) {
+                value = limbs[i + limbShift] >> bitShift;
+                if (bitShift != 0 && i + limbShift + 1 < (int)N)
+                    value |= limbs[i + limbShift + 1] << (64 - bitShift);
+            }
+            limbs[i] = value;
+        }
+        return *this;
+    }
+
+    BigUInt &operator&=(const BigUInt &other) {
+        for (size_t i = 0; i < N; i++)
+            limbs[i] &= other.limbs[i];
+        return *this;
+    }
+
+    BigUInt &operator|=(const BigUInt &other) {
+        for (size_t i = 0; i < N; i++)
+            limbs[i] |= other.limbs[i];
+        return *this;
+    }
+
+    BigUInt operator+() const {
+        return *this;
+    }
+
+    BigUInt operator~() const {
+        BigUInt result;
+        for (size_t i = 0; i < N; i++)
+            result.limbs[i] = ~limbs[i];
+        return result;
+    }
+
+    friend BigUInt operator+(BigUInt a, const BigUInt &b) { return a += b; }
+    friend BigUInt operator-(BigUInt a, const BigUInt &b) { return a -= b; }
+    friend BigUInt operator/(BigUInt a, const BigUInt &b) { return a /= b; }
+    friend BigUInt operator%(BigUInt a, const BigUInt &b) { return a %= b; }
+    friend BigUInt operator&(BigUInt a, const BigUInt &b) { return a &= b; }
+    friend BigUInt operator|(BigUInt a, const BigUInt &b) { return a |= b; }
+    friend BigUInt operator<<(BigUInt a, int shift) { return a <<= shift; }
+    friend BigUInt operator>>(BigUInt a, int shift) { return a >>= shift; }
+
+    // The lower N limbs of the product.
+    friend BigUInt operator*(const BigUInt &a, const BigUInt &b) {
+        BigUInt result;
+        for (size_t i = 0; i < N; i++) {
+            if (a.limbs[i] == 0)
+                continue;
+            uint64_t carry = 0;
+            for (size_t j = 0; i + j < N; j++) {
+                uint128_t product = (uint128_t)a.limbs[i] * b.limbs[j] + result.limbs[i + j] + carry;
+                result.limbs[i + j] = (uint64_t)product;
+                carry = product >> 64;
+            }
+        }
+        return result;
+    }
+
+    // The upper N limbs of the product.
+    friend BigUInt mulHigh(const BigUInt &a, const BigUInt &b) {
+        uint64_t product[2 * N] = {};
+        for (size_t i = 0; i < N; i++) {
+            if (a.limbs[i] == 0)
+                continue;
+            uint64_t carry = 0;
+            for (size_t j = 0; j < N; j++) {
+                uint128_t partial = (uint128_t)a.limbs[i] * b.limbs[j] + product[i + j] + carry;
+                product[i + j] = (uint64_t)partial;
+                carry = partial >> 64;
+            }
+            product[i + N] = carry;
+        }
+        BigUInt result;
+        for (size_t i = 0; i < N; i++)
+            result.limbs[i] = product[i + N];
+        return result;
+    }
+
+    friend int compare(const BigUInt &a, const BigUInt &b) {
+        for (int i = N - 1; i >= 0; i--)
+            if (a.limbs[i] != b.limbs[i])
+                return a.limbs[i] < b.limbs[i] ? -1 : 1;
+        return 0;
+    }
+
+    friend bool operator==(const BigUInt &a, const BigUInt &b) { return compare(a, b) == 0; }
+    friend bool operator!=(const BigUInt &a, const BigUInt &b) { return compare(a, b) != 0; }
+    friend bool operator<(const BigUInt &a, const BigUInt &b) { return compare(a, b) < 0; }
+    friend bool operator<=(const BigUInt &a, const BigUInt &b) { return compare(a, b) <= 0; }
+    friend bool operator>(const BigUInt &a, const BigUInt &b) { return compare(a, b) > 0; }
+    friend bool operator>=(const BigUInt &a, const BigUInt &b) { return compare(a, b) >= 0; }
+
+    // (a * b) % c, c must be less than 2^(64*N-1)
+    friend BigUInt mult(BigUInt a, BigUInt b, const BigUInt &c) {
+        a %= c;
+        BigUInt result;
+        for (int i = b.bitLength() - 1; i >= 0; i--) {
+            result += result;
+            if (result >= c)
+                result -= c;
+            if (b.bit(i)) {
+                result += a;
+                if (result >= c)
+                    result -= c;
+            }
+        }
+        return result;
+    }
+
+    // The same as the generic subtractIfNotLess(), done in a single pass over
+    // the limbs in use: the difference is kept only if it doesn't borrow.
+    friend uint8_t subtractIfNotLess(BigUInt &a, const BigUInt &b) {
+        size_t top = N;
+        while (top > 1 && (a.limbs[top - 1] | b.limbs[top - 1]) == 0)
+            top--;
+        uint64_t difference[N];
+        uint64_t borrow = 0;
+        for (size_t i = 0; i < top; i++) {
+            uint128_t d = (uint128_t)a.limbs[i] - b.limbs[i] - borrow;
+            difference[i] = (uint64_t)d;
+            borrow = (d >> 64) != 0;
+        }
+        uint64_t mask = borrow - 1;
+        for (size_t i = 0; i < top; i++)
+            a.limbs[i] ^= (a.limbs[i] ^ difference[i]) & mask;
+        return mask & 1;
+    }
+
+    friend std::ostream &operator<<(std::ostream &stream, const BigUInt &value) {
+        return stream << value.toString(stream.flags());
+    }
+
+    int bitLength() const {
+        for (int i = N - 1; i >= 0; i--)
+            if (limbs[i] != 0)
+                return i * 64 + 64 - __builtin_clzll(limbs[i]);
+        return 0;
+    }
+
+    bool bit(int index) const {
+        return (limbs[index / 64] >> (index % 64)) & 1;
+    }
+
+private:
+    // Divides the number by a single limb and returns the remainder.
+    uint64_t divideByLimb(uint64_t divisor) {
+        uint128_t remainder = 0;
+        for (int i = N - 1; i >= 0; i--) {
+            uint128_t current = (remainder << 64) | limbs[i];
+            limbs[i] = current / divisor;
+            remainder = current % divisor;
+        }
+        return remainder;
+    }
+
+    static void divide(const BigUInt &a, const BigUInt &b, BigUInt &quotient, BigUInt &remainder) {
+        if (b.bitLength() <= 64) {
+            quotient = a;
+            remainder = quotient.divideByLimb(b.limbs[0]);
+            return;
+        }
+        BigUInt q, r;
+        for (int i = a.bitLength() - 1; i >= 0; i--) {
+            r <<= 1;
+            r.limbs[0] |= a.bit(i);
+            if (r >= b) {
+                r -= b;
+                q.limbs[i / 64] |= (uint64_t)1 << (i % 64);
+            }
+        }
+        quotient = q;
+        remainder = r;
+    }
+
+    std::string toString(std::ios::fmtflags flags) const {
+        bool hex = (flags & std::ios::basefield) == std::ios::hex;
+        const char *digits = (flags & std::ios::uppercase) ? "0123456789ABCDEF" : "0123456789abcdef";
+        std::string result;
+        BigUInt value = *this;
+        do {
+            // 16 hex digits or 19 decimal digits at a time
+            uint64_t chunk;
+            if (hex) {
+                chunk = value.limbs[0];
+                value >>= 64;
+            } else {
+                chunk = value.divideByLimb(10000000000000000000ull);
+            }
+            for (int i = 0; i < (hex ? 16 : 19); i++) {
+                result += digits[chunk % (hex ? 16 : 10)];
+                chunk /= hex ? 16 : 10;
+            }
+        } while (value != 0);
+        while (result.size() > 1 && result.back() == '0')
+            result.pop_back();
+        return std::string(result.rbegin(), result.rend());
+    }
+};
+
+template<size_t N>
+int bitLength(const BigUInt<N> &a) {
+    return a.bitLength();
+}
+
+template<size_t N>
+int trailingZeros(const BigUInt<N> &a) {
+    for (size_t i = 0; i < N; i++)
+        if (a.limbs[i] != 0)
+            return i * 64 + __builtin_ctzll(a.limbs[i]);
+    return N * 64;
+}
+
+// The widest type the key can be stored as. p, q and the private key
+// are parsed and validated using it before the actual type is chosen.
+typedef BigUInt<16> widest_t;
+
+template<typename T>
+T narrowNumber(const widest_t &value) {
+    if constexpr (sizeof(T) <= sizeof(uint64_t)) {
+        return (T)value.limbs[0];
+    } else {
+        T result = 0;
+        for (int i = sizeof(T) / sizeof(uint64_t) - 1; i >= 0; i--)
+            result = (result << 64) | T(value.limbs[i]);
+        return result;
+    }
+}
+
+template<typename T>
+widest_t widenNumber(T value) {
+    widest_t result;
+    for (size_t i = 0; i < (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t); i++) {
+        result.limbs[i] = static_cast<uint64_t>(value);
+        if constexpr (sizeof(T) > sizeof(uint64_t))
+            value >>= 64;
+    }
+    return result;
+}
+
+// Instantiates M(T) for every type the key and the block sums can be stored as.
+#define FOR_EACH_NUMBER_TYPE(M) \
+    M(uint32_t) \
+    M(uint64_t) \
+    M(uint128_t) \
+    M(BigUInt<4>) \
+    M(BigUInt<8>) \
+    M(BigUInt<16>)
@@ -0,0 +1,60 @@
+#include <cstring>
+
+#include "container.hpp"
+#include "biguint.hpp"
+
+static const char CONTAINER_MAGIC[4] = {'K', 'N', 'A', 'P'};
+static const uint8_t CONTAINER_VERSION = 1;
+
+uint8_t getElementWidth(const widest_t &maxValue) {
+    uint8_t width = 1;
+    while (width < 128 && (maxValue >> (8 * width)) != 0)
+        width *= 2;
+    return width;
+}
+
+void storeContainerHeader(uint8_t *dst, const container_header_t &header) {
+    memcpy(dst, CONTAINER_MAGIC, sizeof(CONTAINER_MAGIC));
+    dst[4] = CONTAINER_VERSION;
+    dst[5] = header.elementWidth;
+    storeLittleEndian(&dst[6], header.keyLength, 4);
+    storeLittleEndian(&dst[10], header.bitLength, 8);
+    storeLittleEndian(&dst[18], header.blockCount, 8);
+}
+
+void writeContainerHeader(std::ostream &stream, const container_header_t &header) {
+    uint8_t buffer[CONTAINER_HEADER_SIZE];
+    storeContainerHeader(buffer, header);
+    stream.write((const char *)buffer, sizeof(buffer));
+}
+
+int loadContainerHeader(const uint8_t *src, uint64_t size, container_header_t &header) {
+    if (size < CONTAINER_HEADER_SIZE)
+        return 1;
+    if (memcmp(src, CONTAINER_MAGIC, sizeof(CONTAINER_MAGIC)) != 0 || src[4] != CONTAINER_VERSION)
+        return 1;
+    header.elementWidth = src[5];
+    header.keyLength = loadLittleEndian<uint32_t>(&src[6], 4);
+    header.bitLength = loadLittleEndian<uint64_t>(&src[10], 8);
+    header.blockCount = loadLittleEndian<uint64_t>(&src[18], 8);
+    if (header.elementWidth == 0 || header.elementWidth > 128 || (header.elementWidth & (header.elementWidth - 1)) != 0)
+        return 2;
+    // the blocks have to be there, and they may be short of the original
+    // data by the zero block left out at the end only
+    if (header.blockCount > (size - CONTAINER_HEADER_SIZE) / header.elementWidth || header.keyLength == 0)
+        return 2;
+    if (header.bitLength != 0 && (header.bitLength - 1) / header.keyLength > header.blockCount)
+        return 2;
+    return 0;
+}
+
+int readContainerHeader(std::istream &stream, container_header_t &header) {
+    std::streampos start = stream.tellg();
+    if (start < 0 || !stream.seekg(0, std::ios::end))
+        return 1;
+    uint64_t size = stream.tellg() - start;
+    uint8_t buffer[CONTAINER_HEADER_SIZE];
+    if (!stream.seekg(start) || !stream.read((char *)buffer, sizeof(buffer)))
+        return 1;
+    return loadContainerHeader(buffer, size, header);
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <iostream>
+#include <cstdint>
+#include <cstddef>
+
+#include "biguint.hpp"
+
+// Binary alternative to the hex format of the encrypted data. The file
+// starts with a header followed by the block sums stored as little-endian
+// numbers of elementWidth bytes.
+//
+//   "KNAP" | version (1B) | element width (1B) | key length (4B) |
+//   original bit length (8B) | number of blocks (8B) | blocks...
+struct container_header_t {
+    uint8_t elementWidth;
+    uint32_t keyLength;
+    uint64_t bitLength;  // size of the original data in bits
+    uint64_t blockCount;
+};
+
+const size_t CONTAINER_HEADER_SIZE = 26;
+
+// Stores the lowest width bytes of the value, the least significant first.
+template<typename T>
+void storeLittleEndian(uint8_t *dst, T value, size_t width) {
+    for (size_t i = 0; i < width; i++) {
+        dst[i] = static_cast<uint64_t>(value & 0xFF);
+        value >>= 8;
+    }
+}
+
+template<typename T>
+T loadLittleEndian(const uint8_t *src, size_t width) {
+    T value = 0;
+    for (size_t i = width; i > 0; i--)
+        value = (value << 8) | src[i - 1];
+    return value;
+}
+
+// Returns the number of bytes (a power of two up to 128) needed to store maxValue.
+uint8_t getElementWidth(const widest_t &maxValue);
+
+// Stores the header into the first CONTAINER_HEADER_SIZE bytes of dst.
+void storeContainerHeader(uint8_t *dst, const container_header_t &header);
+
+void writeContainerHeader(std::ostream &stream, const container_header_t &header);
+
+// Loads the header of a container of size bytes, src being the start of it.
+// Returns 0 on success, 1 if it is not a container and 2 if the header is
+// broken or doesn't match the size (the blocks wouldn't fit into it).
+int loadContainerHeader(const uint8_t *src, uint64_t size, container_header_t &header);
+
+// Reads the header of the container the rest of the stream is (checked the
+// same way). Returns 0 on success, 1 if the stream is not a container and 2
+// if the header is broken.
+int readContainerHeader(std::istream &stream, container_header_t &header);
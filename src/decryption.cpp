@@ -0,0 +1,286 @@
+#include "decryption.hpp"
+#include "biguint.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define X86_SIMD
+#endif
+
+#define DECRYPTION_BATCH 256
+
+// ORs the n (at most 64) bits of pattern into out starting at the given bit.
+// The bit n-1 of pattern goes first.
+static inline void writeBits(uint8_t *out, size_t bit, uint64_t pattern, size_t n) {
+    uint128_t v = (uint128_t)pattern << (128 - n) >> (bit % 8);
+    out += bit / 8;
+    for (size_t j = 0; j < (bit % 8 + n + 7) / 8; j++)
+        out[j] |= (uint8_t)(v >> (120 - 8 * j));
+}
+
+template<typename T>
+void findValuesInPrivateKey(const std::vector<T> &privateKey, T n, uint8_t *out, size_t bitOffset) {
+    for (int i = privateKey.size() - 1; i >= 0; i--) {
+        uint8_t take = subtractIfNotLess(n, privateKey[i]);
+        size_t bit = bitOffset + i;
+        out[bit / 8] |= take << (7 - bit % 8);
+    }
+}
+
+// Decomposes count values, the bits of value i starting at bitOffset + i * n.
+template<typename T>
+static void findValuesScalar(const std::vector<T> &privateKey, const T *values, size_t count, uint8_t *out, size_t bitOffset) {
+    for (size_t i = 0; i < count; i++)
+        findValuesInPrivateKey(privateKey, values[i], out, bitOffset + i * privateKey.size());
+}
+
+#ifdef X86_SIMD
+// The same as findValuesScalar(), except each lane decomposes its own value,
+// so 8 or 16 values are walked through the key at once. A value the key
+// is subtracted from gets the bit of the key set in its pattern.
+__attribute__((target("avx2")))
+static void findValuesAvx2(const std::vector<uint32_t> &privateKey, const uint32_t *values, size_t count, uint8_t *out, size_t bitOffset) {
+    size_t n = privateKey.size();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i rest = _mm256_loadu_si256((const __m256i *)(values + i));
+        __m256i pattern = _mm256_setzero_si256();
+        for (int j = n - 1; j >= 0; j--) {
+            __m256i key = _mm256_set1_epi32(privateKey[j]);
+            __m256i take = _mm256_cmpeq_epi32(_mm256_max_epu32(rest, key), rest);
+            rest = _mm256_sub_epi32(rest, _mm256_and_si256(take, key));
+            pattern = _mm256_or_si256(pattern, _mm256_and_si256(take, _mm256_set1_epi32(1u << (n - 1 - j))));
+        }
+        uint32_t patterns[8];
+        _mm256_storeu_si256((__m256i *)patterns, pattern);
+        for (size_t l = 0; l < 8; l++)
+            writeBits(out, bitOffset + (i + l) * n, patterns[l], n);
+    }
+    findValuesScalar(privateKey, values + i, count - i, out, bitOffset + i * n);
+}
+
+// AVX2 compares signed 64-bit numbers only, hence the flipped sign bits.
+__attribute__((target("avx2")))
+static void findValuesAvx2(const std::vector<uint64_t> &privateKey, const uint64_t *values, size_t count, uint8_t *out, size_t bitOffset) {
+    size_t n = privateKey.size();
+    __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256i rest = _mm256_loadu_si256((const __m256i *)(values + i));
+        __m256i pattern = _mm256_setzero_si256();
+        for (int j = n - 1; j >= 0; j--) {
+            __m256i key = _mm256_set1_epi64x(privateKey[j]);
+            __m256i skip = _mm256_cmpgt_epi64(_mm256_xor_si256(key, sign), _mm256_xor_si256(rest, sign));
+            rest = _mm256_sub_epi64(rest, _mm256_andnot_si256(skip, key));
+            pattern = _mm256_or_si256(pattern, _mm256_andnot_si256(skip, _mm256_set1_epi64x((uint64_t)1 << (n - 1 - j))));
+        }
+        uint64_t patterns[4];
+        _mm256_storeu_si256((__m256i *)patterns, pattern);
+        for (size_t l = 0; l < 4; l++)
+            writeBits(out, bitOffset + (i + l) * n, patterns[l], n);
+    }
+    findValuesScalar(privateKey, values + i, count - i, out, bitOffset + i * n);
+}
+
+// the intrinsics pass _mm512_undefined_epi32() as the unused masked-off source
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+__attribute__((target("avx512f")))
+static void findValuesAvx512(const std::vector<uint32_t> &privateKey, const uint32_t *values, size_t count, uint8_t *out, size_t bitOffset) {
+    size_t n = privateKey.size();
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m512i rest = _mm512_loadu_si512(values + i);
+        __m512i pattern = _mm512_setzero_si512();
+        for (int j = n - 1; j >= 0; j--) {
+            __m512i key = _mm512_set1_epi32(privateKey[j]);
+            __mmask16 take = _mm512_cmpge_epu32_mask(rest, key);
+            rest = _mm512_mask_sub_epi32(rest, take, rest, key);
+            pattern = _mm512_mask_or_epi32(pattern, take, pattern, _mm512_set1_epi32(1u << (n - 1 - j)));
+        }
+        uint32_t patterns[16];
+        _mm512_storeu_si512(patterns, pattern);
+        for (size_t l = 0; l < 16; l++)
+            writeBits(out, bitOffset + (i + l) * n, patterns[l], n);
+    }
+    findValuesScalar(privateKey, values + i, count - i, out, bitOffset + i * n);
+}
+
+__attribute__((target("avx512f")))
+static void findValuesAvx512(const std::vector<uint64_t> &privateKey, const uint64_t *values, size_t count, uint8_t *out, size_t bitOffset) {
+    size_t n = privateKey.size();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m512i rest = _mm512_loadu_si512(values + i);
+        __m512i pattern = _mm512_setzero_si512();
+        for (int j = n - 1; j >= 0; j--) {
+            __m512i key = _mm512_set1_epi64(privateKey[j]);
+            __mmask8 take = _mm512_cmpge_epu64_mask(rest, key);
+            rest = _mm512_mask_sub_epi64(rest, take, rest, key);
+            pattern = _mm512_mask_or_epi64(pattern, take, pattern, _mm512_set1_epi64((uint64_t)1 << (n - 1 - j)));
+        }
+        uint64_t patterns[8];
+        _mm512_storeu_si512(patterns, pattern);
+        for (size_t l = 0; l < 8; l++)
+            writeBits(out, bitOffset + (i + l) * n, patterns[l], n);
+    }
+    findValuesScalar(privateKey, values + i, count - i, out, bitOffset + i * n);
+}
+#pragma GCC diagnostic pop
+#endif
+
+template<typename T>
+using find_values_kernel_t = void (*)(const std::vector<T> &, const T *, size_t, uint8_t *, size_t);
+
+// The kernels keep the bits of a value in a single lane, so the key
+// can't be longer than the lanes are wide.
+template<typename T>
+static find_values_kernel_t<T> selectFindValuesKernel(size_t keyLength) {
+#ifdef X86_SIMD
+    if constexpr (std::is_same_v<T, uint32_t> || std::is_same_v<T, uint64_t>) {
+        if (keyLength <= (size_t)bitsOf<T>() && __builtin_cpu_supports("avx512f"))
+            return findValuesAvx512;
+        if (keyLength <= (size_t)bitsOf<T>() && __builtin_cpu_supports("avx2"))
+            return findValuesAvx2;
+    }
+#endif
+    (void)keyLength;
+    return findValuesScalar<T>;
+}
+
+// The percentage of the bits set under which jumping is faster than walking
+// through the key. Jumping costs a few comparisons for every bit set, while
+// the linear way costs one compare-and-subtract for every value of the key.
+// The thresholds are where the times of decryptJump and decryptLinear cross
+// in ./benchmark (see benchDecomposition()): 2-4 % when the lanes decompose
+// several blocks at once, about 20 % for a scalar built-in type, and 35-40 %
+// for BigUInt, whose compare-and-subtract takes a pass over the limbs.
+template<typename T>
+static int getJumpThreshold(size_t keyLength) {
+    if (selectFindValuesKernel<T>(keyLength) != findValuesScalar<T>)
+        return 3;
+    if constexpr (std::is_same_v<T, uint32_t> || std::is_same_v<T, uint64_t> || std::is_same_v<T, uint128_t>)
+        return 20;
+    return 35;
+}
+
+template<typename T>
+key_index_t buildKeyIndex(const std::vector<T> &privateKey, decomposition_t mode) {
+    key_index_t index = {std::vector<int>(bitsOf<T>() + 1, -1), mode, getJumpThreshold<T>(privateKey.size())};
+    for (size_t i = 0; i < privateKey.size(); i++)
+        for (int length = bitLength(privateKey[i]); length <= bitsOf<T>(); length++)
+            index.lastOfLength[length] = i;
+    return index;
+}
+
+template<typename T>
+void findValuesInPrivateKey(const std::vector<T> &privateKey, const key_index_t &index, T n, uint8_t *out, size_t bitOffset) {
+    int last = privateKey.size() - 1;
+    while (n != 0 && last >= 0) {
+        // values shorter than n are not greater than it, the ones as long have to be compared
+        int length = bitLength(n);
+        int i = std::min(last, index.lastOfLength[length]);
+        while (i > index.lastOfLength[length - 1] && privateKey[i] > n)
+            i--;
+        if (i < 0)
+            return;
+        n -= privateKey[i];
+        size_t bit = bitOffset + i;
+        out[bit / 8] |= 0x80 >> (bit % 8);
+        last = i - 1;
+    }
+}
+
+template<typename T>
+static void findValuesByJumping(const std::vector<T> &privateKey, const key_index_t &index, const T *values, size_t count, uint8_t *out, size_t bitOffset) {
+    for (size_t i = 0; i < count; i++)
+        findValuesInPrivateKey(privateKey, index, values[i], out, bitOffset + i * privateKey.size());
+}
+
+// Counts 8 bytes at a time, since it's a library call without POPCNT.
+static size_t countBitsSet(const uint8_t *data, size_t size) {
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, data + i, 8);
+        count += __builtin_popcountll(word);
+    }
+    for (; i < size; i++)
+        count += __builtin_popcount(data[i]);
+    return count;
+}
+
+template<typename T>
+void decryptBlocks(const std::vector<T> &privateKey, const key_index_t &index, const T *blocks, size_t count, const shoup_multiplier_t<T> &invertedP, uint8_t *out) {
+    size_t n = privateKey.size();
+    auto findValues = selectFindValuesKernel<T>(n);
+    bool jump = index.mode == DECOMPOSITION_JUMP;
+    // the blocks are multiplied by p^(-1) and decomposed in batches,
+    // so both of the steps can be vectorized
+    T values[DECRYPTION_BATCH];
+    for (size_t i = 0; i < count; i += DECRYPTION_BATCH) {
+        size_t batch = std::min(count - i, (size_t)DECRYPTION_BATCH);
+        mult(invertedP, blocks + i, batch, values);
+        if (jump)
+            findValuesByJumping(privateKey, index, values, batch, out, i * n);
+        else
+            findValues(privateKey, values, batch, out, i * n);
+
+        // the next batch is decomposed the way that suits this one better
+        if (index.mode == DECOMPOSITION_AUTO) {
+            size_t first = i * n / 8, last = ((i + batch) * n + 7) / 8;
+            jump = countBitsSet(out + first, last - first) * 100 < index.jumpBelow * (last - first) * 8;
+        }
+    }
+}
+
+template<typename T>
+bool fitsDecodeTable(size_t keyLength, T q, size_t limit) {
+    return keyLength <= 32 && widenNumber(q) <= widest_t(limit / sizeof(uint32_t));
+}
+
+template<typename T>
+decode_table_t buildDecodeTable(const std::vector<T> &privateKey, T q, ThreadPool &pool) {
+    size_t n = privateKey.size();
+    auto patterns = std::make_shared<std::vector<uint32_t>>(static_cast<uint64_t>(q));
+    pool.parallelFor(patterns->size(), 1, [&](size_t begin, size_t end) {
+        for (size_t x = begin; x < end; x++) {
+            T rest = T(x);
+            uint32_t pattern = 0;
+            for (int i = n - 1; i >= 0 && rest != 0; i--)
+                if (privateKey[i] <= rest) {
+                    rest -= privateKey[i];
+                    pattern |= (uint32_t)1 << (n - 1 - i);
+                }
+            (*patterns)[x] = pattern;
+        }
+    });
+    return {n, patterns->size(), patterns->data(), patterns};
+}
+
+template<typename T>
+void decryptBlocks(const decode_table_t &table, const T *blocks, size_t count, const shoup_multiplier_t<T> &invertedP, uint8_t *out) {
+    size_t n = table.keyLength;
+    T values[DECRYPTION_BATCH];
+    for (size_t i = 0; i < count; i += DECRYPTION_BATCH) {
+        size_t batch = std::min(count - i, (size_t)DECRYPTION_BATCH);
+        mult(invertedP, blocks + i, batch, values);
+        for (size_t j = 0; j < batch; j++)
+            writeBits(out, (i + j) * n, table.patterns[static_cast<uint64_t>(values[j])], n);
+    }
+}
+
+#define INSTANTIATE_DECRYPTION(T) \
+    template void findValuesInPrivateKey(const std::vector<T> &, T, uint8_t *, size_t); \
+    template void decryptBlocks(const std::vector<T> &, const key_index_t &, const T *, size_t, const shoup_multiplier_t<T> &, uint8_t *); \
+    template key_index_t buildKeyIndex(const std::vector<T> &, decomposition_t); \
+    template void findValuesInPrivateKey(const std::vector<T> &, const key_index_t &, T, uint8_t *, size_t); \
+    template bool fitsDecodeTable(size_t, T, size_t); \
+    template decode_table_t buildDecodeTable(const std::vector<T> &, T, ThreadPool &); \
+    template void decryptBlocks(const decode_table_t &, const T *, size_t, const shoup_multiplier_t<T> &, uint8_t *);
+
+FOR_EACH_NUMBER_TYPE(INSTANTIATE_DECRYPTION)
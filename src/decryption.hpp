@@ -0,0 +1,76 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+#include "arithmetic.hpp"
+#include "thread_pool.hpp"
+
+// Decomposes n into the values of the (super-increasing) private key and
+// sets the bits of the values used. Bit i of the block is the bit at
+// position bitOffset + i of out (the most significant bit of a byte first).
+// Bits of the values not used are left untouched, so out is expected to
+// be zeroed out.
+template<typename T>
+void findValuesInPrivateKey(const std::vector<T> &privateKey, T n, uint8_t *out, size_t bitOffset);
+
+// How the blocks are decomposed into the values of the private key.
+enum decomposition_t {
+    DECOMPOSITION_LINEAR, // walking through all the values of the key
+    DECOMPOSITION_JUMP,   // jumping between the values used, see key_index_t
+    DECOMPOSITION_AUTO    // either of them, depending on the share of the bits set
+};
+
+// For every bit length, the last value of the private key which is no longer
+// than that (-1 if there is none). Since the key is super-increasing, there are
+// at most two values of the same length, so the next value a block is made of
+// is found right away instead of walking through all the values between.
+struct key_index_t {
+    std::vector<int> lastOfLength;
+    decomposition_t mode;
+    int jumpBelow; // percentage of the bits set under which DECOMPOSITION_AUTO jumps
+};
+
+template<typename T>
+key_index_t buildKeyIndex(const std::vector<T> &privateKey, decomposition_t mode);
+
+// The same as findValuesInPrivateKey() above, except it jumps between the
+// values used, so the cost depends on the number of bits set in the block
+// rather than on the length of the key.
+template<typename T>
+void findValuesInPrivateKey(const std::vector<T> &privateKey, const key_index_t &index, T n, uint8_t *out, size_t bitOffset);
+
+// Decrypts count blocks and writes their bits into out, which must be
+// zeroed out and large enough to hold privateKey.size() bits per block.
+// invertedP is the multiplier by p^(-1) modulo q.
+template<typename T>
+void decryptBlocks(const std::vector<T> &privateKey, const key_index_t &index, const T *blocks, size_t count, const shoup_multiplier_t<T> &invertedP, uint8_t *out);
+
+// Decoded bits of every value x < q a block can be turned into (once
+// multiplied by p^(-1) modulo q), indexed by x. Bit n-1-i of a pattern
+// stands for the value i of the private key, so the patterns are copied to
+// the output as they are. Only keys of up to 32 values can have a table.
+// The patterns are either built by buildDecodeTable() or mapped from
+// a keyring (see keyring.hpp), whichever owner keeps them alive.
+struct decode_table_t {
+    size_t keyLength;
+    size_t size;
+    const uint32_t *patterns; // nullptr if there is no table
+    std::shared_ptr<const void> owner;
+};
+
+// Returns true if the table for a key of keyLength values and the modulus q
+// takes up no more than limit bytes.
+template<typename T>
+bool fitsDecodeTable(size_t keyLength, T q, size_t limit);
+
+template<typename T>
+decode_table_t buildDecodeTable(const std::vector<T> &privateKey, T q, ThreadPool &pool);
+
+// The same as decryptBlocks() above, except each block is decoded by a single
+// lookup once it has been multiplied by p^(-1). A block is a sum of up to n
+// values of the public key, so it is usually not less than q itself.
+template<typename T>
+void decryptBlocks(const decode_table_t &table, const T *blocks, size_t count, const shoup_multiplier_t<T> &invertedP, uint8_t *out);
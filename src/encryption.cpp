@@ -0,0 +1,228 @@
+#include <numeric>
+#include <algorithm>
+#include <type_traits>
+
+#include "encryption.hpp"
+#include "biguint.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define X86_SIMD
+#endif
+
+// count (at most 16) bits of data starting at the given bit, the first of
+// them being the most significant one. Bits past the end of data are zeros.
+static inline uint32_t loadBits(const uint8_t *data, size_t size, size_t bit, int count) {
+    uint32_t word = 0;
+    for (size_t i = bit / 8; i < bit / 8 + 3; i++)
+        word = (word << 8) | (i < size ? data[i] : 0);
+    return ((word << (bit % 8)) >> (24 - count)) & ((1u << count) - 1);
+}
+
+template<typename T>
+static T sumBlockScalar(const T *laneKey, size_t groups, const uint8_t *data, size_t size, size_t bit) {
+    T sum = 0;
+    for (size_t g = 0; g < groups; g++) {
+        uint32_t bits = loadBits(data, size, bit + g * 8, 8);
+        for (int i = 0; i < 8; i++)
+            sum += laneKey[g * 8 + i] & (T(0) - T((bits >> i) & 1));
+    }
+    return sum;
+}
+
+#ifdef X86_SIMD
+// AVX2 has no mask registers, so the bits are broadcast to all the lanes
+// and compared with the bit each lane stands for.
+__attribute__((target("avx2")))
+static uint32_t sumBlockAvx2(const uint32_t *laneKey, size_t groups, const uint8_t *data, size_t size, size_t bit) {
+    __m256i laneBits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    __m256i sum = _mm256_setzero_si256();
+    for (size_t g = 0; g < groups; g++) {
+        __m256i bits = _mm256_set1_epi32(loadBits(data, size, bit + g * 8, 8));
+        __m256i mask = _mm256_cmpeq_epi32(_mm256_and_si256(bits, laneBits), laneBits);
+        __m256i key = _mm256_loadu_si256((const __m256i *)(laneKey + g * 8));
+        sum = _mm256_add_epi32(sum, _mm256_and_si256(mask, key));
+    }
+    uint32_t lanes[8];
+    _mm256_storeu_si256((__m256i *)lanes, sum);
+    return std::accumulate(lanes, lanes + 8, (uint32_t)0);
+}
+
+__attribute__((target("avx2")))
+static uint64_t sumBlockAvx2(const uint64_t *laneKey, size_t groups, const uint8_t *data, size_t size, size_t bit) {
+    __m256i laneBits = _mm256_setr_epi64x(1, 2, 4, 8);
+    __m256i sum = _mm256_setzero_si256();
+    for (size_t g = 0; g < groups; g++) {
+        __m256i bits = _mm256_set1_epi64x(loadBits(data, size, bit + g * 4, 4));
+        __m256i mask = _mm256_cmpeq_epi64(_mm256_and_si256(bits, laneBits), laneBits);
+        __m256i key = _mm256_loadu_si256((const __m256i *)(laneKey + g * 4));
+        sum = _mm256_add_epi64(sum, _mm256_and_si256(mask, key));
+    }
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, sum);
+    return std::accumulate(lanes, lanes + 4, (uint64_t)0);
+}
+
+// the intrinsics pass _mm512_undefined_epi32() as the unused masked-off source
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+__attribute__((target("avx512f")))
+static uint32_t sumBlockAvx512(const uint32_t *laneKey, size_t groups, const uint8_t *data, size_t size, size_t bit) {
+    __m512i sum = _mm512_setzero_si512();
+    for (size_t g = 0; g < groups; g++) {
+        __mmask16 bits = loadBits(data, size, bit + g * 16, 16);
+        sum = _mm512_mask_add_epi32(sum, bits, sum, _mm512_loadu_si512(laneKey + g * 16));
+    }
+    uint32_t lanes[16];
+    _mm512_storeu_si512(lanes, sum);
+    return std::accumulate(lanes, lanes + 16, (uint32_t)0);
+}
+
+__attribute__((target("avx512f")))
+static uint64_t sumBlockAvx512(const uint64_t *laneKey, size_t groups, const uint8_t *data, size_t size, size_t bit) {
+    __m512i sum = _mm512_setzero_si512();
+    for (size_t g = 0; g < groups; g++) {
+        __mmask8 bits = loadBits(data, size, bit + g * 8, 8);
+        sum = _mm512_mask_add_epi64(sum, bits, sum, _mm512_loadu_si512(laneKey + g * 8));
+    }
+    uint64_t lanes[8];
+    _mm512_storeu_si512(lanes, sum);
+    return std::accumulate(lanes, lanes + 8, (uint64_t)0);
+}
+#pragma GCC diagnostic pop
+#endif
+
+// Picks the kernel the CPU supports and the number of lanes it works with.
+template<typename T>
+static void selectSumBlockKernel(encryption_table_t<T> &table) {
+    table.lanes = 8;
+    table.sumBlock = sumBlockScalar<T>;
+#ifdef X86_SIMD
+    if constexpr (std::is_same_v<T, uint32_t> || std::is_same_v<T, uint64_t>) {
+        if (__builtin_cpu_supports("avx512f")) {
+            table.lanes = 64 / sizeof(T);
+            table.sumBlock = sumBlockAvx512;
+        } else if (__builtin_cpu_supports("avx2")) {
+            table.lanes = 32 / sizeof(T);
+            table.sumBlock = sumBlockAvx2;
+        }
+    }
+#endif
+}
+
+template<typename T>
+static void buildLaneKey(const std::vector<T> &publicKey, encryption_table_t<T> &table) {
+    selectSumBlockKernel(table);
+    size_t lanes = table.lanes;
+    table.laneKey.assign((publicKey.size() + lanes - 1) / lanes * lanes, 0);
+    for (size_t i = 0; i < publicKey.size(); i++)
+        table.laneKey[i / lanes * lanes + lanes - 1 - i % lanes] = publicKey[i];
+}
+
+template<typename T>
+encryption_table_t<T> buildEncryptionTable(const std::vector<T> &publicKey, size_t limit) {
+    encryption_table_t<T> table;
+    size_t n = publicKey.size();
+    size_t periodBits = std::lcm(n, (size_t)8);
+
+    table.keyLength = n;
+    table.bytesPerPeriod = periodBits / 8;
+    table.blocksPerPeriod = periodBits / n;
+
+    size_t segments = 0;
+    for (size_t j = 0; j < table.bytesPerPeriod; j++)
+        segments += (j * 8 + 7) / n - j * 8 / n + 1;
+    if (segments * 256 * sizeof(T) > limit) {
+        buildLaneKey(publicKey, table);
+        return table;
+    }
+
+    for (size_t j = 0; j < table.bytesPerPeriod; j++) {
+        table.byteSegments.push_back(table.segmentBlock.size());
+        int bit = 0;
+        while (bit < 8) {
+            size_t firstBit = j * 8 + bit;
+            size_t block = firstBit / n;
+            size_t segmentEnd = std::min((block + 1) * n - j * 8, (size_t)8);
+
+            table.segmentBlock.push_back(block);
+            size_t base = table.sums.size();
+            table.sums.resize(base + 256, 0);
+            for (int v = 1; v < 256; v++) {
+                T sum = 0;
+                for (size_t b = bit; b < segmentEnd; b++)
+                    if ((v >> (7 - b)) & 1)
+                        sum += publicKey[(j * 8 + b) % n];
+                table.sums[base + v] = sum;
+            }
+            bit = segmentEnd;
+        }
+    }
+    table.byteSegments.push_back(table.segmentBlock.size());
+    return table;
+}
+
+// Writes all the blocks the bytes are part of, including the last incomplete one.
+template<typename T>
+static void encryptRangeByTable(const encryption_table_t<T> &table, const uint8_t *data, size_t size, T *blocks) {
+    std::fill(blocks, blocks + (size * 8 + table.keyLength - 1) / table.keyLength, T(0));
+
+    const uint32_t *byteSegments = table.byteSegments.data();
+    const uint32_t *segmentBlock = table.segmentBlock.data();
+    const T *sums = table.sums.data();
+    size_t j = 0;
+
+    for (size_t i = 0; i < size; i++) {
+        uint8_t v = data[i];
+        for (uint32_t s = byteSegments[j]; s < byteSegments[j + 1]; s++)
+            blocks[segmentBlock[s]] += sums[s * 256 + v];
+        if (++j == table.bytesPerPeriod) {
+            j = 0;
+            blocks += table.blocksPerPeriod;
+        }
+    }
+}
+
+// The same as above, using the dot product of the bits of each block with the key.
+template<typename T>
+static void encryptRangeByKernel(const encryption_table_t<T> &table, const uint8_t *data, size_t size, T *blocks) {
+    size_t n = table.keyLength;
+    size_t groups = (n + table.lanes - 1) / table.lanes;
+    size_t count = (size * 8 + n - 1) / n;
+    for (size_t i = 0; i < count; i++)
+        blocks[i] = table.sumBlock(table.laneKey.data(), groups, data, size, i * n);
+}
+
+template<typename T>
+static void encryptRange(const encryption_table_t<T> &table, const uint8_t *data, size_t size, T *blocks) {
+    if (table.sums.empty())
+        encryptRangeByKernel(table, data, size, blocks);
+    else
+        encryptRangeByTable(table, data, size, blocks);
+}
+
+template<typename T>
+static T *resizeOutput(const encryption_table_t<T> &table, size_t size, std::vector<T> &out) {
+    size_t base = out.size();
+    out.resize(base + (size * 8 + table.keyLength - 1) / table.keyLength);
+    return out.data() + base;
+}
+
+template<typename T>
+static void dropEmptyPartialBlock(const encryption_table_t<T> &table, size_t size, std::vector<T> &out) {
+    if ((size * 8) % table.keyLength != 0 && out.back() == 0)
+        out.pop_back();
+}
+
+template<typename T>
+void encryptBytes(const encryption_table_t<T> &table, const uint8_t *data, size_t size, std::vector<T> &out) {
+    T *blocks = resizeOutput(table, size, out);
+    encryptRange(table, data, size, blocks);
+    dropEmptyPartialBlock(table, size, out);
+}
+
+#define INSTANTIATE_ENCRYPTION(T) \
+    template encryption_table_t<T> buildEncryptionTable(const std::vector<T> &, size_t); \
+    template void encryptBytes(const encryption_table_t<T> &, const uint8_t *, size_t, std::vector<T> &);
+
+FOR_EACH_NUMBER_TYPE(INSTANTIATE_ENCRYPTION)
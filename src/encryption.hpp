@@ -0,0 +1,39 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Precomputed partial sums of the public key used to encrypt the input
+// a whole byte at a time. Blocks are n bits long (n = length of the key),
+// so the way bytes overlap blocks repeats every lcm(n, 8) bits - a period.
+// Each byte within a period touches one or more blocks; every such pair
+// (byte, block) is a segment holding a 256-entry table of partial sums.
+template<typename T>
+struct encryption_table_t {
+    size_t keyLength;
+    size_t bytesPerPeriod;
+    size_t blocksPerPeriod;
+    std::vector<uint32_t> byteSegments; // first segment of each byte (+ sentinel)
+    std::vector<uint32_t> segmentBlock; // block (relative to the period) of each segment
+    std::vector<T> sums;                // 256 partial sums per segment
+
+    // If the sums would take up too much memory, each block is summed up
+    // as a dot product of its bits with the public key instead. The key is
+    // split into groups of `lanes` values, each of them stored in the reverse
+    // order (the last one zero-padded), so that bit i of the group's bits
+    // selects lane i. sumBlock() is the AVX-512, AVX2 or scalar kernel.
+    size_t lanes;
+    std::vector<T> laneKey;
+    T (*sumBlock)(const T *laneKey, size_t groups, const uint8_t *data, size_t size, size_t bit);
+};
+
+// The sums are left out if they would take up more than limit bytes.
+template<typename T>
+encryption_table_t<T> buildEncryptionTable(const std::vector<T> &publicKey, size_t limit);
+
+// Encrypts size bytes that start at a block boundary and appends the block
+// sums to out. The last incomplete block is appended only if its sum is not
+// zero, which is how the input has always been encrypted.
+template<typename T>
+void encryptBytes(const encryption_table_t<T> &table, const uint8_t *data, size_t size, std::vector<T> &out);
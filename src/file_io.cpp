@@ -0,0 +1,350 @@
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+
+#include "file_io.hpp"
+
+// An io_uring set up by the system calls themselves (the rings shared with
+// the kernel are mapped into memory), so that no library is needed.
+class Uring {
+public:
+    Uring() {
+        io_uring_params params = {};
+        fd = (int)syscall(__NR_io_uring_setup, IO_QUEUE_DEPTH, &params);
+        if (fd < 0)
+            return;
+        sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single)
+            sqSize = cqSize = std::max(sqSize, cqSize);
+        sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        sqRing = mmap(nullptr, sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        cqRing = single ? sqRing : mmap(nullptr, cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        sqes = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (sqRing == MAP_FAILED || cqRing == MAP_FAILED || sqes == MAP_FAILED) {
+            release();
+            return;
+        }
+        uint8_t *sq = (uint8_t *)sqRing;
+        sqTail = (unsigned *)(sq + params.sq_off.tail);
+        sqMask = *(unsigned *)(sq + params.sq_off.ring_mask);
+        sqArray = (unsigned *)(sq + params.sq_off.array);
+        uint8_t *cq = (uint8_t *)cqRing;
+        cqHead = (unsigned *)(cq + params.cq_off.head);
+        cqTail = (unsigned *)(cq + params.cq_off.tail);
+        cqMask = *(unsigned *)(cq + params.cq_off.ring_mask);
+        cqes = (io_uring_cqe *)(cq + params.cq_off.cqes);
+    }
+
+    ~Uring() {
+        release();
+    }
+
+    Uring(const Uring &) = delete;
+    Uring &operator=(const Uring &) = delete;
+
+    bool ready() const {
+        return fd >= 0;
+    }
+
+    // Reads (or writes) size bytes of the file starting at offset, a chunk
+    // per request. A request done only partly is sent again for the rest.
+    bool transfer(int file, bool write, uint64_t offset, uint8_t *data, size_t size) {
+        std::vector<unsigned> idle;
+        for (unsigned i = 0; i < IO_QUEUE_DEPTH; i++)
+            idle.push_back(i);
+        size_t queued = 0;
+        unsigned inFlight = 0;
+        bool failed = false;
+        while (inFlight > 0 || (queued < size && !failed)) {
+            while (queued < size && !failed && !idle.empty()) {
+                unsigned slot = idle.back();
+                idle.pop_back();
+                size_t length = std::min(IO_CHUNK_SIZE, size - queued);
+                requests[slot] = {{data + queued, length}, offset + queued};
+                queue(file, write, slot);
+                queued += length;
+                inFlight++;
+            }
+            // the requests left in flight are cancelled once the ring is closed
+            if (!enter())
+                return false;
+
+            unsigned head = *cqHead;
+            unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+            for (; head != tail; head++) {
+                const io_uring_cqe &cqe = cqes[head & cqMask];
+                unsigned slot = (unsigned)cqe.user_data;
+                request_t &request = requests[slot];
+                if (cqe.res == -EINTR || cqe.res == -EAGAIN) {
+                    queue(file, write, slot);
+                    continue;
+                }
+                if (cqe.res > 0 && (size_t)cqe.res < request.iov.iov_len && !failed) {
+                    request.iov.iov_base = (uint8_t *)request.iov.iov_base + cqe.res;
+                    request.iov.iov_len -= cqe.res;
+                    request.offset += cqe.res;
+                    queue(file, write, slot);
+                    continue;
+                }
+                // nothing read means the file ends before the data
+                if (cqe.res <= 0)
+                    failed = true;
+                idle.push_back(slot);
+                inFlight--;
+            }
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+        }
+        return !failed;
+    }
+
+private:
+    struct request_t {
+        iovec iov;
+        uint64_t offset;
+    };
+
+    void queue(int file, bool write, unsigned slot) {
+        unsigned tail = *sqTail;
+        unsigned index = tail & sqMask;
+        io_uring_sqe &sqe = ((io_uring_sqe *)sqes)[index];
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = write ? IORING_OP_WRITEV : IORING_OP_READV;
+        sqe.fd = file;
+        sqe.off = requests[slot].offset;
+        sqe.addr = (uint64_t)(uintptr_t)&requests[slot].iov;
+        sqe.len = 1;
+        sqe.user_data = slot;
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+        toSubmit++;
+    }
+
+    // Submits the queued requests and waits for one of them to be done.
+    bool enter() {
+        while (true) {
+            long submitted = syscall(__NR_io_uring_enter, fd, toSubmit, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (submitted >= 0) {
+                toSubmit -= submitted;
+                return true;
+            }
+            if (errno != EINTR)
+                return false;
+        }
+    }
+
+    void release() {
+        if (sqes != MAP_FAILED)
+            munmap(sqes, sqesSize);
+        if (cqRing != MAP_FAILED && cqRing != sqRing)
+            munmap(cqRing, cqSize);
+        if (sqRing != MAP_FAILED)
+            munmap(sqRing, sqSize);
+        sqes = cqRing = sqRing = MAP_FAILED;
+        if (fd >= 0)
+            close(fd);
+        fd = -1;
+    }
+
+    int fd = -1;
+    void *sqRing = MAP_FAILED;
+    void *cqRing = MAP_FAILED;
+    void *sqes = MAP_FAILED;
+    size_t sqSize = 0;
+    size_t cqSize = 0;
+    size_t sqesSize = 0;
+    unsigned *sqTail = nullptr;
+    unsigned sqMask = 0;
+    unsigned *sqArray = nullptr;
+    unsigned *cqHead = nullptr;
+    unsigned *cqTail = nullptr;
+    unsigned cqMask = 0;
+    io_uring_cqe *cqes = nullptr;
+    unsigned toSubmit = 0;
+    request_t requests[IO_QUEUE_DEPTH];
+};
+
+// Files which can't be seeked in (pipes, terminals) are read and written
+// one piece after another regardless of offset.
+static bool transferBlocking(int file, bool seekable, bool write, uint64_t offset, uint8_t *data, size_t size) {
+    while (size > 0) {
+        ssize_t done;
+        if (seekable)
+            done = write ? pwrite(file, data, size, offset) : pread(file, data, size, offset);
+        else
+            done = write ? ::write(file, data, size) : read(file, data, size);
+        if (done < 0 && errno == EINTR)
+            continue;
+        if (done <= 0)
+            return false;
+        data += done;
+        size -= done;
+        offset += done;
+    }
+    return true;
+}
+
+// Data fitting into a single chunk is transferred by a blocking call, as
+// there would be nothing to keep in flight along with it.
+static bool transfer(int file, bool write, uint64_t offset, uint8_t *data, size_t size, io_backend_t backend) {
+    struct stat status;
+    if (fstat(file, &status) != 0)
+        return false;
+    bool seekable = S_ISREG(status.st_mode) || S_ISBLK(status.st_mode);
+    if (backend == IO_BACKEND_URING && seekable && size > IO_CHUNK_SIZE) {
+        Uring ring;
+        if (ring.ready())
+            return ring.transfer(file, write, offset, data, size);
+    }
+    return transferBlocking(file, seekable, write, offset, data, size);
+}
+
+bool isUringSupported() {
+    static const bool supported = Uring().ready();
+    return supported;
+}
+
+int readFile(const std::string &fileName, std::vector<uint8_t> &data, io_backend_t backend) {
+    int file = open(fileName.c_str(), O_RDONLY);
+    if (file < 0)
+        return 1;
+    struct stat status;
+    bool ok = fstat(file, &status) == 0;
+    if (ok && S_ISREG(status.st_mode)) {
+        data.resize(status.st_size);
+        ok = transfer(file, false, 0, data.data(), data.size(), backend);
+    } else if (ok) {
+        // the size of a pipe isn't known, so it is read till the end
+        data.clear();
+        uint8_t buffer[65536];
+        ssize_t size;
+        while ((size = read(file, buffer, sizeof(buffer))) != 0) {
+            if (size < 0 && errno == EINTR)
+                continue;
+            if (size < 0) {
+                ok = false;
+                break;
+            }
+            data.insert(data.end(), buffer, buffer + size);
+        }
+    }
+    close(file);
+    return ok ? 0 : 1;
+}
+
+int readFile(const std::string &fileName, uint64_t offset, uint8_t *data, size_t size, io_backend_t backend) {
+    int file = open(fileName.c_str(), O_RDONLY);
+    if (file < 0)
+        return 1;
+    bool ok = transfer(file, false, offset, data, size, backend);
+    close(file);
+    return ok ? 0 : 1;
+}
+
+int writeFile(const std::string &fileName, const uint8_t *data, size_t size, bool append, io_backend_t backend) {
+    int file = open(fileName.c_str(), O_WRONLY | O_CREAT | (append ? 0 : O_TRUNC), 0666);
+    if (file < 0)
+        return 1;
+    struct stat status;
+    bool ok = fstat(file, &status) == 0;
+    uint64_t offset = ok && append && S_ISREG(status.st_mode) ? status.st_size : 0;
+    ok = ok && transfer(file, true, offset, (uint8_t *)data, size, backend);
+    return close(file) == 0 && ok ? 0 : 1;
+}
+
+int writeFile(const std::string &fileName, uint64_t offset, const uint8_t *data, size_t size, io_backend_t backend) {
+    int file = open(fileName.c_str(), O_WRONLY | O_CREAT, 0666);
+    if (file < 0)
+        return 1;
+    bool ok = transfer(file, true, offset, (uint8_t *)data, size, backend);
+    return close(file) == 0 && ok ? 0 : 1;
+}
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+int MappedFile::open(const std::string &fileName, io_backend_t backend) {
+    close();
+    int file = ::open(fileName.c_str(), O_RDONLY);
+    if (file < 0)
+        return 1;
+    struct stat status;
+    if (fstat(file, &status) == 0 && S_ISREG(status.st_mode) && status.st_size > 0) {
+        void *address = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+        if (address != MAP_FAILED) {
+            mapping = (uint8_t *)address;
+            mappingSize = length = status.st_size;
+            madvise(mapping, mappingSize, MADV_SEQUENTIAL);
+            madvise(mapping, mappingSize, MADV_WILLNEED);
+        }
+    }
+    ::close(file);
+    if (mapping != nullptr)
+        return 0;
+    if (readFile(fileName, buffer, backend) != 0)
+        return 1;
+    length = buffer.size();
+    return 0;
+}
+
+int MappedFile::create(const std::string &fileName, size_t size) {
+    close();
+    fd = ::open(fileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0)
+        return 1;
+    if (ftruncate(fd, size) != 0) {
+        close();
+        return 1;
+    }
+    length = size;
+    void *address = size > 0 ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    if (address != MAP_FAILED) {
+        mapping = (uint8_t *)address;
+        mappingSize = size;
+        return 0;
+    }
+    // the data is written into the file by truncate()
+    buffer.assign(size, 0);
+    writeBack = true;
+    return 0;
+}
+
+void MappedFile::allocate(size_t size) {
+    close();
+    buffer.assign(size, 0);
+    length = size;
+}
+
+int MappedFile::truncate(size_t size) {
+    length = std::min(length, size);
+    if (fd < 0) {
+        if (mapping == nullptr)
+            buffer.resize(length);
+        return 0;
+    }
+    bool ok = ftruncate(fd, length) == 0;
+    if (writeBack)
+        ok = ok && transferBlocking(fd, true, true, 0, buffer.data(), length);
+    return ok ? 0 : 1;
+}
+
+void MappedFile::close() {
+    if (mapping != nullptr)
+        munmap(mapping, mappingSize);
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+    mapping = nullptr;
+    mappingSize = length = 0;
+    buffer.clear();
+    writeBack = false;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Reading and writing files, whole or a piece at a time. The io_uring backend
+// splits the data into chunks of IO_CHUNK_SIZE bytes and keeps up to
+// IO_QUEUE_DEPTH of them in flight at a time. Where the kernel doesn't support
+// io_uring, the files are read and written by blocking system calls instead.
+enum io_backend_t {
+    IO_BACKEND_BLOCKING,
+    IO_BACKEND_URING
+};
+
+const size_t IO_CHUNK_SIZE = 1 << 20;
+const unsigned IO_QUEUE_DEPTH = 16;
+
+// Whether an io_uring can be set up (checked once).
+bool isUringSupported();
+
+// Reads the whole file into data. Returns 0 on success, 1 if the file
+// couldn't be read.
+int readFile(const std::string &fileName, std::vector<uint8_t> &data, io_backend_t backend);
+
+// Reads size bytes of the file starting at offset. Returns 0 on success,
+// 1 if the file couldn't be read or it ends before them.
+int readFile(const std::string &fileName, uint64_t offset, uint8_t *data, size_t size, io_backend_t backend);
+
+// Writes size bytes into the file, replacing it or appending to it. Returns
+// 0 on success, 1 if the file couldn't be written.
+int writeFile(const std::string &fileName, const uint8_t *data, size_t size, bool append, io_backend_t backend);
+
+// Writes size bytes into the file starting at offset, creating the file if it
+// doesn't exist. Returns 0 on success, 1 if the file couldn't be written.
+int writeFile(const std::string &fileName, uint64_t offset, const uint8_t *data, size_t size, io_backend_t backend);
+
+// A file mapped into memory, so that it is read and written right where the
+// data is processed instead of being copied through a buffer. A file which
+// can't be mapped (a pipe, or where mmap() fails) is held in memory instead.
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    // Maps the file for reading. The kernel is told that it is going to be
+    // read sequentially, so it reads ahead. Returns 0 on success, 1 if the
+    // file couldn't be read.
+    int open(const std::string &fileName, io_backend_t backend);
+
+    // Creates (or replaces) a file of the given size and maps it for writing.
+    // Returns 0 on success, 1 if the file couldn't be created.
+    int create(const std::string &fileName, size_t size);
+
+    // Holds size zero bytes in memory, with no file behind them.
+    void allocate(size_t size);
+
+    // Cuts the data (and the file, if it has been created) down to size bytes.
+    // Returns 0 on success, 1 if the file couldn't be written.
+    int truncate(size_t size);
+
+    void close();
+
+    uint8_t *data() {
+        return mapping != nullptr ? mapping : buffer.data();
+    }
+
+    const uint8_t *data() const {
+        return mapping != nullptr ? mapping : buffer.data();
+    }
+
+    size_t size() const {
+        return length;
+    }
+
+    bool empty() const {
+        return length == 0;
+    }
+
+    // Whether the data is backed by a file created by create().
+    bool isCreated() const {
+        return fd >= 0;
+    }
+
+    uint8_t operator[](size_t i) const {
+        return data()[i];
+    }
+
+private:
+    int fd = -1; // kept open for a created file only
+    uint8_t *mapping = nullptr;
+    size_t mappingSize = 0;
+    size_t length = 0;
+    std::vector<uint8_t> buffer;
+    bool writeBack = false; // the file has been created, but couldn't be mapped
+};
@@ -0,0 +1,105 @@
+#include <array>
+#include <algorithm>
+#include <cstring>
+
+#include "hex.hpp"
+
+static const char HEX_DIGITS[] = "0123456789ABCDEF";
+
+// The two digits of each byte, the more significant one first.
+static constexpr std::array<char, 512> makeDigitPairs() {
+    std::array<char, 512> pairs = {};
+    for (int i = 0; i < 256; i++) {
+        pairs[2 * i] = HEX_DIGITS[i >> 4];
+        pairs[2 * i + 1] = HEX_DIGITS[i & 0xF];
+    }
+    return pairs;
+}
+
+// The value of each character taken for a digit, 0xFF if it isn't one.
+static constexpr std::array<uint8_t, 256> makeDigitValues() {
+    std::array<uint8_t, 256> values = {};
+    for (int i = 0; i < 256; i++)
+        values[i] = 0xFF;
+    for (int i = 0; i < 10; i++)
+        values['0' + i] = i;
+    for (int i = 0; i < 6; i++)
+        values['A' + i] = values['a' + i] = 10 + i;
+    return values;
+}
+
+static constexpr std::array<char, 512> DIGIT_PAIRS = makeDigitPairs();
+static constexpr std::array<uint8_t, 256> DIGIT_VALUES = makeDigitValues();
+
+size_t formatHex(char *dst, const uint8_t *value, size_t width, int hexPadding) {
+    size_t bytes = width;
+    while (bytes > 1 && value[bytes - 1] == 0)
+        bytes--;
+    // the most significant byte has a single digit unless it is 0x10 or more
+    uint8_t top = value[bytes - 1];
+    size_t digits = 2 * bytes - (top < 0x10);
+    size_t length = 0;
+    if ((int)digits < hexPadding) {
+        length = hexPadding - digits;
+        memset(dst, '0', length);
+    }
+    if (top < 0x10)
+        dst[length++] = HEX_DIGITS[top];
+    else {
+        memcpy(&dst[length], &DIGIT_PAIRS[2 * top], 2);
+        length += 2;
+    }
+    for (size_t i = bytes - 1; i > 0; i--) {
+        memcpy(&dst[length], &DIGIT_PAIRS[2 * value[i - 1]], 2);
+        length += 2;
+    }
+    dst[length++] = ' ';
+    return length;
+}
+
+int parseHex(const char *text, size_t size, size_t width, std::vector<uint8_t> &blocks, size_t &count) {
+    const char *end = (const char *)memchr(text, '\n', size);
+    if (end == nullptr)
+        end = text + size;
+    // there are no more numbers than the spaces around them
+    blocks.assign((std::count(text, end, ' ') + 1) * width, 0);
+    count = 0;
+    const char *c = text;
+    while (true) {
+        while (c != end && *c == ' ')
+            c++;
+        if (c == end)
+            break;
+        uint8_t *block = &blocks[count * width];
+        const char *first = c;
+        while (c != end && *c != ' ')
+            c++;
+        while (c - first > 1 && *first == '0')
+            first++;
+        if ((size_t)(c - first) > 2 * width) {
+            bool number = std::all_of(first, c, [](char digit) {
+                return DIGIT_VALUES[(uint8_t)digit] != 0xFF;
+            });
+            return number ? 2 : 1;
+        }
+
+        // the digits are taken in pairs from the least significant ones
+        const char *digit = c;
+        for (; digit - first >= 2; digit -= 2) {
+            uint8_t high = DIGIT_VALUES[(uint8_t)digit[-2]];
+            uint8_t low = DIGIT_VALUES[(uint8_t)digit[-1]];
+            if ((high | low) > 0xF)
+                return 1;
+            *block++ = (high << 4) | low;
+        }
+        if (digit != first) {
+            uint8_t low = DIGIT_VALUES[(uint8_t)first[0]];
+            if (low > 0xF)
+                return 1;
+            *block = low;
+        }
+        count++;
+    }
+    blocks.resize(count * width);
+    return 0;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// The hexadecimal format of the encrypted data: the blocks are written as
+// uppercase hexadecimal numbers padded with zeros to --hex-padding digits,
+// each of them followed by a space. The digits are formatted two at a time
+// (a byte of the number), but parsed by looking up each digit on its own:
+// a table of the pairs takes 128 KB and measured slower than that.
+
+// The most characters formatHex() writes: a number of 128 bytes padded to at
+// most 255 digits, followed by a space.
+const size_t MAX_HEX_LENGTH = 257;
+
+// Writes the little-endian number of width bytes as hexadecimal digits padded
+// with zeros to hexPadding digits and followed by a space (as the streams do).
+// Returns the number of characters written.
+size_t formatHex(char *dst, const uint8_t *value, size_t width, int hexPadding);
+
+// Parses the hexadecimal numbers separated by spaces up to the end of the
+// first line of the text (lowercase digits and any padding are accepted) into
+// little-endian numbers of width bytes each, which replace the blocks. Returns
+// 0 on success, 1 if there is something else than a number and 2 if some of
+// the numbers don't fit into width bytes.
+int parseHex(const char *text, size_t size, size_t width, std::vector<uint8_t> &blocks, size_t &count);
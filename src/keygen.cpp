@@ -0,0 +1,208 @@
+#include <algorithm>
+
+#include "keygen.hpp"
+
+#define SMALL_PRIME_LIMIT 65536
+#define TRIAL_DIVISION_LIMIT 1024
+#define PRIME_BASES 12 // the primes up to 37, the bases of the first rounds
+
+const size_t LIMBS = sizeof(widest_t) / sizeof(uint64_t);
+
+// The primes less than SMALL_PRIME_LIMIT (sieve of Eratosthenes).
+static const std::vector<uint32_t> &smallPrimes() {
+    static const std::vector<uint32_t> primes = []() {
+        std::vector<uint32_t> result;
+        std::vector<bool> composite(SMALL_PRIME_LIMIT, false);
+        for (uint32_t i = 2; i < SMALL_PRIME_LIMIT; i++) {
+            if (composite[i])
+                continue;
+            result.push_back(i);
+            for (uint32_t j = i * i; j < SMALL_PRIME_LIMIT; j += i)
+                composite[j] = true;
+        }
+        return result;
+    }();
+    return primes;
+}
+
+// A uniformly distributed number in [0, limit), limit must not be 0.
+static widest_t randomBelow(std::mt19937_64 &rng, const widest_t &limit) {
+    int bits = bitLength(limit);
+    widest_t x;
+    do {
+        for (int i = 0; i < (bits + 63) / 64; i++)
+            x.limbs[i] = rng();
+        if (bits % 64 != 0)
+            x.limbs[(bits - 1) / 64] &= ((uint64_t)1 << (bits % 64)) - 1;
+    } while (x >= limit);
+    return x;
+}
+
+// Montgomery multiplication modulo an odd m of k limbs. A value x is kept
+// as x * R mod m, R = 2^(64k), so that the products need no division
+// (mult() of BigUInt takes a pass over all the limbs per bit).
+struct montgomery_t {
+    widest_t m;
+    size_t k;
+    uint64_t mInv; // -m^(-1) mod 2^64
+    widest_t r2;   // R^2 mod m
+};
+
+static montgomery_t makeMontgomery(const widest_t &m) {
+    montgomery_t ctx;
+    ctx.m = m;
+    ctx.k = (bitLength(m) + 63) / 64;
+    // m * m = 1 (mod 8), and every Newton's step doubles the bits that are correct
+    uint64_t inv = m.limbs[0];
+    for (int i = 0; i < 5; i++)
+        inv *= 2 - m.limbs[0] * inv;
+    ctx.mInv = -inv;
+    // doubled 2 * 64k times, without overflowing when m is close to 2^(64 * LIMBS)
+    ctx.r2 = 1;
+    for (size_t i = 0; i < 128 * ctx.k; i++) {
+        if (ctx.r2 >= m - ctx.r2)
+            ctx.r2 -= m - ctx.r2;
+        else
+            ctx.r2 += ctx.r2;
+    }
+    return ctx;
+}
+
+// a * b / R mod m (the CIOS method)
+static widest_t montgomeryMult(const montgomery_t &ctx, const widest_t &a, const widest_t &b) {
+    size_t k = ctx.k;
+    uint64_t t[LIMBS + 2] = {};
+    for (size_t i = 0; i < k; i++) {
+        uint64_t carry = 0;
+        for (size_t j = 0; j < k; j++) {
+            uint128_t x = (uint128_t)a.limbs[j] * b.limbs[i] + t[j] + carry;
+            t[j] = x;
+            carry = x >> 64;
+        }
+        uint128_t x = (uint128_t)t[k] + carry;
+        t[k] = x;
+        t[k + 1] = x >> 64;
+
+        // adds u * m, which makes the lowest limb zero, and drops the limb
+        uint64_t u = t[0] * ctx.mInv;
+        carry = ((uint128_t)u * ctx.m.limbs[0] + t[0]) >> 64;
+        for (size_t j = 1; j < k; j++) {
+            x = (uint128_t)u * ctx.m.limbs[j] + t[j] + carry;
+            t[j - 1] = x;
+            carry = x >> 64;
+        }
+        x = (uint128_t)t[k] + carry;
+        t[k - 1] = x;
+        t[k] = t[k + 1] + (uint64_t)(x >> 64);
+    }
+    // t < 2m
+    widest_t result;
+    for (size_t i = 0; i <= k && i < LIMBS; i++)
+        result.limbs[i] = t[i];
+    if ((k == LIMBS && t[k] != 0) || result >= ctx.m)
+        result -= ctx.m;
+    return result;
+}
+
+// base^e, both the base and the result in the Montgomery form
+static widest_t montgomeryPow(const montgomery_t &ctx, const widest_t &base, const widest_t &e, const widest_t &one) {
+    widest_t result = one;
+    for (int i = bitLength(e) - 1; i >= 0; i--) {
+        result = montgomeryMult(ctx, result, result);
+        if (e.bit(i))
+            result = montgomeryMult(ctx, result, base);
+    }
+    return result;
+}
+
+// n must be odd and greater than the largest base (37).
+static bool millerRabin(const widest_t &n, std::mt19937_64 &rng, int rounds) {
+    widest_t d = n - 1;
+    int s = trailingZeros(d);
+    d >>= s;
+    montgomery_t ctx = makeMontgomery(n);
+    widest_t one = montgomeryMult(ctx, 1, ctx.r2);
+    widest_t minusOne = montgomeryMult(ctx, n - 1, ctx.r2);
+    for (int round = 0; round < rounds; round++) {
+        widest_t base = round < PRIME_BASES ? widest_t(smallPrimes()[round]) : 2 + randomBelow(rng, n - 3);
+        widest_t x = montgomeryPow(ctx, montgomeryMult(ctx, base, ctx.r2), d, one);
+        if (x == one || x == minusOne)
+            continue;
+        int r = 1;
+        for (; r < s; r++) {
+            x = montgomeryMult(ctx, x, x);
+            if (x == minusOne)
+                break;
+        }
+        if (r == s)
+            return false;
+    }
+    return true;
+}
+
+bool isProbablePrime(const widest_t &n, std::mt19937_64 &rng, int rounds) {
+    if (n < 2)
+        return false;
+    for (uint32_t p : smallPrimes()) {
+        if (p >= TRIAL_DIVISION_LIMIT)
+            break;
+        if (n == p)
+            return true;
+        if (n % p == 0)
+            return false;
+    }
+    return millerRabin(n, rng, rounds);
+}
+
+widest_t nextPrime(widest_t n, std::mt19937_64 &rng) {
+    if (n <= 2)
+        return 2;
+    if (!n.bit(0))
+        n += 1;
+    // a candidate below SMALL_PRIME_LIMIT may be one of the small primes
+    // itself, which the remainders below would rule out
+    if (n < SMALL_PRIME_LIMIT) {
+        while (!isProbablePrime(n, rng))
+            n += 2;
+        return n;
+    }
+    // the remainders are updated as the candidate moves on, so most of
+    // the candidates are ruled out without a single multiplication
+    const std::vector<uint32_t> &primes = smallPrimes();
+    std::vector<uint32_t> remainders;
+    for (uint32_t p : primes)
+        remainders.push_back((uint64_t)(n % p));
+    while (true) {
+        bool divisible = false;
+        for (size_t i = 0; i < primes.size(); i++)
+            divisible |= remainders[i] == 0;
+        if (!divisible && millerRabin(n, rng, MILLER_RABIN_ROUNDS))
+            return n;
+        n += 2;
+        for (size_t i = 0; i < primes.size(); i++) {
+            remainders[i] += 2;
+            if (remainders[i] >= primes[i])
+                remainders[i] -= primes[i];
+        }
+    }
+}
+
+int generateKey(size_t length, std::mt19937_64 &rng, generated_key_t &key) {
+    // q < 2^(bits-1) and the block sums up to length * (q - 1) must fit
+    const int maxBits = bitsOf<widest_t>() - 2;
+    key.privateKey.clear();
+    widest_t sum = 0;
+    for (size_t i = 0; i < length; i++) {
+        key.privateKey.push_back(sum + 1 + randomBelow(rng, (sum >> 4) + 16));
+        sum += key.privateKey.back();
+        if (bitLength(sum) > maxBits)
+            return 1;
+    }
+    key.q = nextPrime(sum + 1 + randomBelow(rng, (sum >> 4) + 16), rng);
+    if (bitLength(key.q) > maxBits || key.q - 1 > ~widest_t(0) / std::max(length, (size_t)1))
+        return 1;
+    do {
+        key.p = 2 + randomBelow(rng, key.q - 2);
+    } while (binaryGcd(key.p, key.q) != 1);
+    return 0;
+}
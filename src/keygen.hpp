@@ -0,0 +1,33 @@
+#pragma once
+
+#include <vector>
+#include <random>
+#include <cstddef>
+
+#include "biguint.hpp"
+
+// Number of Miller-Rabin rounds a prime has to pass.
+#define MILLER_RABIN_ROUNDS 24
+
+// Returns false if n is composite, true if it is a prime with the
+// probability of at least 1 - 4^(-rounds). The first rounds use the primes
+// up to 37 as the bases, which makes the test exact for n < 3.3 * 10^24.
+bool isProbablePrime(const widest_t &n, std::mt19937_64 &rng, int rounds = MILLER_RABIN_ROUNDS);
+
+// The smallest prime not less than n (a probable prime from 65536
+// on). The candidates are sieved by the small primes before they are given
+// the same Miller-Rabin rounds as by isProbablePrime().
+widest_t nextPrime(widest_t n, std::mt19937_64 &rng);
+
+struct generated_key_t {
+    std::vector<widest_t> privateKey;
+    widest_t p;
+    widest_t q;
+};
+
+// Generates a random super-increasing private key of the given length,
+// a prime q greater than the sum of its values and a random p relatively
+// prime to q. Every value of the key exceeds the sum of the previous ones
+// by a random amount of up to 1/16 of the sum, so the key takes about
+// 1.1 bits per value. Returns 1 if q doesn't fit into widest_t.
+int generateKey(size_t length, std::mt19937_64 &rng, generated_key_t &key);
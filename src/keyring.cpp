@@ -0,0 +1,136 @@
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "keyring.hpp"
+#include "container.hpp"
+
+static const char KEYRING_MAGIC[4] = {'K', 'N', 'K', 'R'};
+// Version 1 indexed the decode table by the blocks themselves.
+static const uint8_t KEYRING_VERSION = 2;
+
+static uint64_t checksum(const uint8_t *data, size_t size) {
+    uint64_t hash = 14695981039346656037ull;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+        hash = (hash ^ loadLittleEndian<uint64_t>(&data[i], 8)) * 1099511628211ull;
+    if (i < size)
+        hash = (hash ^ loadLittleEndian<uint64_t>(&data[i], size - i)) * 1099511628211ull;
+    return hash;
+}
+
+// The decode table starts at the first multiple of 8 past the values.
+static size_t getDecodeTableOffset(uint64_t keyLength, uint8_t width) {
+    return ((3 + 2 * keyLength) * width + 7) / 8 * 8;
+}
+
+// A value of width bytes, loaded a limb at a time.
+static widest_t loadValue(const uint8_t *src, size_t width) {
+    widest_t value;
+    for (size_t i = 0; i < width; i += 8)
+        value.limbs[i / 8] = loadLittleEndian<uint64_t>(&src[i], std::min(width - i, (size_t)8));
+    return value;
+}
+
+template<typename T>
+int writeKeyring(const std::string &fileName, T p, T q, T invertedP, const std::vector<T> &privateKey, const std::vector<T> &publicKey, const decode_table_t &decodeTable) {
+    size_t n = privateKey.size();
+    uint8_t width = getElementWidth(widenNumber(q));
+    size_t tableSize = decodeTable.patterns != nullptr ? decodeTable.size : 0;
+    size_t tableOffset = getDecodeTableOffset(n, width);
+
+    std::vector<uint8_t> payload(tableOffset + tableSize * sizeof(uint32_t), 0);
+    uint8_t *dst = payload.data();
+    for (T x : {p, q, invertedP}) {
+        storeLittleEndian(dst, x, width);
+        dst += width;
+    }
+    for (const std::vector<T> *key : {&privateKey, &publicKey}) {
+        for (T x : *key) {
+            storeLittleEndian(dst, x, width);
+            dst += width;
+        }
+    }
+    for (size_t i = 0; i < tableSize; i++)
+        storeLittleEndian(&payload[tableOffset + i * sizeof(uint32_t)], decodeTable.patterns[i], sizeof(uint32_t));
+
+    uint8_t header[KEYRING_HEADER_SIZE] = {};
+    memcpy(header, KEYRING_MAGIC, sizeof(KEYRING_MAGIC));
+    header[4] = KEYRING_VERSION;
+    header[5] = width;
+    storeLittleEndian(&header[8], (uint32_t)n, 4);
+    storeLittleEndian(&header[12], (uint64_t)tableSize, 8);
+    storeLittleEndian(&header[20], checksum(payload.data(), payload.size()), 8);
+
+    std::ofstream file(fileName, std::ios::binary);
+    if (file.fail())
+        return 1;
+    file.write((const char *)header, sizeof(header));
+    file.write((const char *)payload.data(), payload.size());
+    return file.good() ? 0 : 1;
+}
+
+int mapKeyring(const std::string &fileName, bool verify, keyring_t &keyring) {
+    int fd = open(fileName.c_str(), O_RDONLY);
+    if (fd < 0)
+        return 1;
+    struct stat status;
+    if (fstat(fd, &status) != 0 || (size_t)status.st_size < KEYRING_HEADER_SIZE) {
+        close(fd);
+        return 2;
+    }
+    size_t size = status.st_size;
+    void *address = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (address == MAP_FAILED)
+        return 2;
+    std::shared_ptr<const void> mapping(address, [size](const void *p) {
+        munmap(const_cast<void *>(p), size);
+    });
+
+    const uint8_t *data = (const uint8_t *)address;
+    if (memcmp(data, KEYRING_MAGIC, sizeof(KEYRING_MAGIC)) != 0 || data[4] != KEYRING_VERSION)
+        return 2;
+    uint8_t width = data[5];
+    uint64_t n = loadLittleEndian<uint32_t>(&data[8], 4);
+    uint64_t tableSize = loadLittleEndian<uint64_t>(&data[12], 8);
+    if (width == 0 || width > sizeof(widest_t) || (width & (width - 1)) != 0 || n == 0)
+        return 2;
+    const uint8_t *payload = data + KEYRING_HEADER_SIZE;
+    size_t payloadSize = size - KEYRING_HEADER_SIZE;
+    size_t tableOffset = getDecodeTableOffset(n, width);
+    if (tableSize > payloadSize / sizeof(uint32_t) || tableOffset + tableSize * sizeof(uint32_t) != payloadSize)
+        return 2;
+    if (verify && checksum(payload, payloadSize) != loadLittleEndian<uint64_t>(&data[20], 8))
+        return 3;
+
+    keyring.p = loadValue(&payload[0], width);
+    keyring.q = loadValue(&payload[width], width);
+    keyring.invertedP = loadValue(&payload[2 * width], width);
+    // the table is indexed by the blocks multiplied by p^(-1) modulo q
+    if (tableSize != 0 && widest_t(tableSize) != keyring.q)
+        return 2;
+    keyring.privateKey.clear();
+    keyring.publicKey.clear();
+    for (size_t i = 0; i < n; i++) {
+        keyring.privateKey.push_back(loadValue(&payload[(3 + i) * width], width));
+        keyring.publicKey.push_back(loadValue(&payload[(3 + n + i) * width], width));
+    }
+    // the patterns are used right from the mapped file, which is possible
+    // only if they are stored in the byte order of the machine
+    keyring.decodeTable = {n, 0, nullptr, nullptr};
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if (tableSize != 0)
+        keyring.decodeTable = {n, tableSize, (const uint32_t *)&payload[tableOffset], mapping};
+#endif
+    return 0;
+}
+
+#define INSTANTIATE_KEYRING(T) \
+    template int writeKeyring(const std::string &, T, T, T, const std::vector<T> &, const std::vector<T> &, const decode_table_t &);
+
+FOR_EACH_NUMBER_TYPE(INSTANTIATE_KEYRING)
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+#include "biguint.hpp"
+#include "decryption.hpp"
+
+// Binary file holding a validated private key along with everything derived
+// from it, so a run doesn't have to parse, validate or derive anything. All
+// the numbers are little-endian, the values are stored in elementWidth bytes
+// each (as in the container) and the decode table (if any) is stored so that
+// it can be used right from the memory the file is mapped into.
+//
+//   "KNKR" | version (1B) | element width (1B) | reserved (2B) | key length (4B) |
+//   decode table size (8B) | checksum (8B) | reserved (4B) |
+//   p | q | p^(-1) | private key | public key | padding to 8B | decode table (4B each)
+//
+// The checksum (FNV-1a over 64-bit words) covers everything after the header.
+const size_t KEYRING_HEADER_SIZE = 32;
+
+struct keyring_t {
+    widest_t p;
+    widest_t q;
+    widest_t invertedP;
+    std::vector<widest_t> privateKey;
+    std::vector<widest_t> publicKey;
+    decode_table_t decodeTable; // points into the mapped file
+};
+
+// Writes the keyring. The decode table is left out if its patterns are nullptr.
+// Returns 0 on success, 1 if the file couldn't be written.
+template<typename T>
+int writeKeyring(const std::string &fileName, T p, T q, T invertedP, const std::vector<T> &privateKey, const std::vector<T> &publicKey, const decode_table_t &decodeTable);
+
+// Maps the keyring into memory. The mapping is kept as long as the decode
+// table (or a copy of it) exists. Returns 0 on success, 1 if the file doesn't
+// exist, 2 if it is not a keyring and 3 if the checksum doesn't match.
+int mapKeyring(const std::string &fileName, bool verify, keyring_t &keyring);
@@ -0,0 +1,75 @@
+#include <sstream>
+
+#include "keys.hpp"
+
+std::string strip(const std::string &str) {
+    auto start_it = str.begin();
+    auto end_it = str.rbegin();
+
+    while (std::isspace(*start_it))
+        ++start_it;
+    while (std::isspace(*end_it))
+        ++end_it;
+    return std::string(start_it, end_it.base());
+}
+
+std::vector<std::string> split(std::string& str, char separator) {
+    str = strip(str);
+    std::vector<std::string> tokens;
+    std::stringstream ss(str);
+    std::string token;
+    while (getline(ss, token, separator)) {
+        if (token.length() > 0 && std::isspace(token[0]))
+            token = strip(token);
+        if (token != "")
+            tokens.push_back(token);
+    }
+    return tokens;
+}
+
+int parseKey(std::string str, std::vector<widest_t> &key) {
+    auto tokens = split(str, KEY_FILE_SEPARATOR);
+    for (auto token : tokens) {
+        widest_t value;
+        if (!parseNumber(token, value))
+            return 1;
+        key.push_back(value);
+    }
+    if (key.empty())
+        return 2;
+    return 0;
+}
+
+bool relativelyPrime(const widest_t &p, const widest_t &q) {
+    return binaryGcd(p, q) == 1;
+}
+
+bool isSuperincreasing(const std::vector<widest_t> &seq, widest_t &sum) {
+    const widest_t max = ~widest_t(0);
+    sum = 0;
+    for (int i = 0; i < (int)seq.size(); i++) {
+        if (i == 0) {
+            sum += seq[i];
+            continue;
+        } else {
+            if (seq[i] < seq[i-1] || seq[i] < sum)
+                return false;
+            sum = seq[i] > max - sum ? max : sum + seq[i];
+        }
+    }
+    return true;
+}
+
+template<typename T>
+std::vector<T> makePublicKey(const std::vector<T> &privateKey, T p, T q) {
+    std::vector<T> publicKey;
+    auto multiplier = makeShoupMultiplier(p, q);
+    for (const T &x : privateKey)
+        publicKey.push_back(mult(multiplier, x));
+    return publicKey;
+}
+
+#define INSTANTIATE_KEYS(T) \
+    template std::vector<T> makePublicKey(const std::vector<T> &, T, T);
+
+FOR_EACH_NUMBER_TYPE(INSTANTIATE_KEYS)
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "biguint.hpp"
+
+#define KEY_FILE_SEPARATOR ','
+
+std::string strip(const std::string &str);
+std::vector<std::string> split(std::string &str, char separator);
+
+// Parses the values of a key separated by KEY_FILE_SEPARATOR (the content
+// of a key file). Returns 0 on success, 1 if some of the values are not
+// numbers and 2 if there are no values at all.
+int parseKey(std::string str, std::vector<widest_t> &key);
+
+bool relativelyPrime(const widest_t &p, const widest_t &q);
+
+// Returns false if the sequence is not super-increasing. The sum
+// saturates at the maximum value of widest_t.
+bool isSuperincreasing(const std::vector<widest_t> &seq, widest_t &sum);
+
+// public[i] = (p * private[i]) % q
+template<typename T>
+std::vector<T> makePublicKey(const std::vector<T> &privateKey, T p, T q);
@@ -0,0 +1,351 @@
+#include <numeric>
+#include <algorithm>
+#include <atomic>
+
+#include "knapsack.hpp"
+#include "arithmetic.hpp"
+#include "encryption.hpp"
+#include "container.hpp"
+#include "keyring.hpp"
+#include "keys.hpp"
+
+// Block sums are at most n * (q - 1), and the modular arithmetic needs
+// q < 2^(bits-1), where bits is the size of T.
+template<typename T>
+static bool fitsInto(const widest_t &q, size_t n) {
+    const int bits = bitsOf<T>();
+    widest_t max = bits == bitsOf<widest_t>() ? ~widest_t(0) : (widest_t(1) << bits) - 1;
+    return q < (widest_t(1) << (bits - 1)) && q - 1 <= max / n;
+}
+
+// Calls f(T()) with the narrowest type T a key of n values and q fit
+// into. Returns false if there is none.
+template<typename F>
+static bool withNumberType(const widest_t &q, size_t n, F f) {
+    if (fitsInto<uint32_t>(q, n))
+        f(uint32_t());
+    else if (fitsInto<uint64_t>(q, n))
+        f(uint64_t());
+    else if (fitsInto<uint128_t>(q, n))
+        f(uint128_t());
+    else if (fitsInto<BigUInt<4>>(q, n))
+        f(BigUInt<4>());
+    else if (fitsInto<BigUInt<8>>(q, n))
+        f(BigUInt<8>());
+    else if (fitsInto<BigUInt<16>>(q, n))
+        f(BigUInt<16>());
+    else
+        return false;
+    return true;
+}
+
+template<typename T>
+static std::vector<T> narrowKey(const std::vector<widest_t> &key) {
+    std::vector<T> narrowed;
+    for (const widest_t &x : key)
+        narrowed.push_back(narrowNumber<T>(x));
+    return narrowed;
+}
+
+// The key is stored both as widest_t (for the accessors) and as the
+// narrowest type T it fits into (for the encryption and the decryption),
+// which is what the engines are made for.
+struct KeyPair::State {
+    widest_t p;
+    widest_t q;
+    widest_t invertedP;
+    std::vector<widest_t> privateKey;
+    std::vector<widest_t> publicKey;
+    uint8_t elementWidth;
+    decode_table_t decodeTable; // mapped from a keyring, if any
+
+    virtual ~State() {}
+    virtual std::shared_ptr<const Encryptor::Engine> makeEncryptor(const std::shared_ptr<const State> &self, size_t tableLimit) const = 0;
+    virtual std::shared_ptr<const Decryptor::Engine> makeDecryptor(const std::shared_ptr<const State> &self, size_t decodeTableLimit, decomposition_t decomposition, ThreadPool *pool) const = 0;
+    virtual int save(const std::string &fileName, size_t decodeTableLimit, ThreadPool *pool) const = 0;
+};
+
+struct Encryptor::Engine {
+    size_t keyLength;
+    uint8_t elementWidth;
+
+    virtual ~Engine() {}
+    virtual size_t encrypt(const uint8_t *data, size_t size, uint8_t *out, ThreadPool *pool) const = 0;
+};
+
+struct Decryptor::Engine {
+    size_t keyLength;
+    uint8_t elementWidth;
+
+    virtual ~Engine() {}
+    virtual void decrypt(const uint8_t *blocks, size_t count, uint8_t *out, ThreadPool *pool) const = 0;
+};
+
+template<typename T>
+struct TypedState : KeyPair::State {
+    std::vector<T> privateValues;
+    std::vector<T> publicValues;
+    T narrowQ;
+    T narrowInvertedP;
+
+    std::shared_ptr<const Encryptor::Engine> makeEncryptor(const std::shared_ptr<const State> &self, size_t tableLimit) const override;
+    std::shared_ptr<const Decryptor::Engine> makeDecryptor(const std::shared_ptr<const State> &self, size_t decodeTableLimit, decomposition_t decomposition, ThreadPool *pool) const override;
+    int save(const std::string &fileName, size_t decodeTableLimit, ThreadPool *pool) const override;
+
+    // Either the table mapped from the keyring (if it has q patterns) or a new one, unless
+    // it takes up more than limit bytes.
+    decode_table_t getDecodeTable(size_t limit, ThreadPool *pool) const;
+};
+
+// The engines convert between T and the little-endian blocks a chunk of
+// about SCRATCH_BLOCKS blocks (whole periods of lcm(n, 8) bits) at a time,
+// so that no copy of the whole data is made.
+#define SCRATCH_BLOCKS 1024
+
+// The number of blocks of a chunk made of whole periods of the given blocks.
+static size_t getChunkBlocks(size_t periodBlocks) {
+    return std::max(SCRATCH_BLOCKS / periodBlocks, (size_t)1) * periodBlocks;
+}
+
+template<typename T>
+struct TypedEncryptor : Encryptor::Engine {
+    std::shared_ptr<const TypedState<T>> key; // keeps the key alive
+    encryption_table_t<T> table;
+
+    size_t encrypt(const uint8_t *data, size_t size, uint8_t *out, ThreadPool *pool) const override {
+        size_t n = keyLength;
+        size_t chunkBytes = getChunkBlocks(table.blocksPerPeriod) / table.blocksPerPeriod * table.bytesPerPeriod;
+        // only the very last chunk may end within a block, which is left
+        // out if its sum is zero
+        std::atomic<bool> dropped(false);
+        auto encryptRange = [&](size_t begin, size_t end) {
+            std::vector<T> blocks;
+            for (size_t chunk = begin; chunk < end; chunk += chunkBytes) {
+                size_t length = std::min(chunkBytes, end - chunk);
+                blocks.clear();
+                encryptBytes(table, data + chunk, length, blocks);
+                uint8_t *dst = &out[chunk * 8 / n * elementWidth];
+                for (size_t i = 0; i < blocks.size(); i++)
+                    storeLittleEndian(&dst[i * elementWidth], blocks[i], elementWidth);
+                if (blocks.size() < (length * 8 + n - 1) / n)
+                    dropped = true;
+            }
+        };
+        if (pool == nullptr)
+            encryptRange(0, size);
+        else
+            pool->parallelFor(size, table.bytesPerPeriod, encryptRange);
+        return (size * 8 + n - 1) / n - dropped;
+    }
+};
+
+template<typename T>
+struct TypedDecryptor : Decryptor::Engine {
+    std::shared_ptr<const TypedState<T>> key;
+    key_index_t keyIndex;
+    decode_table_t decodeTable;
+    shoup_multiplier_t<T> invertedP;
+
+    void decryptRange(const T *blocks, size_t count, uint8_t *out) const {
+        if (decodeTable.patterns == nullptr)
+            decryptBlocks(key->privateValues, keyIndex, blocks, count, invertedP, out);
+        else
+            decryptBlocks(decodeTable, blocks, count, invertedP, out);
+    }
+
+    void decrypt(const uint8_t *data, size_t count, uint8_t *out, ThreadPool *pool) const override {
+        // Ranges (and chunks) made of whole periods start at a byte boundary,
+        // so the threads never write into the same byte.
+        size_t n = keyLength;
+        size_t periodBlocks = std::lcm(n, (size_t)8) / n;
+        size_t chunkBlocks = getChunkBlocks(periodBlocks);
+        auto decryptBytes = [&](size_t begin, size_t end) {
+            std::vector<T> blocks(std::min(chunkBlocks, end - begin));
+            for (size_t chunk = begin; chunk < end; chunk += chunkBlocks) {
+                size_t length = std::min(chunkBlocks, end - chunk);
+                for (size_t i = 0; i < length; i++)
+                    blocks[i] = loadLittleEndian<T>(&data[(chunk + i) * elementWidth], elementWidth);
+                decryptRange(blocks.data(), length, &out[chunk * n / 8]);
+            }
+        };
+        if (pool == nullptr)
+            decryptBytes(0, count);
+        else
+            pool->parallelFor(count, periodBlocks, decryptBytes);
+    }
+};
+
+template<typename T>
+std::shared_ptr<const Encryptor::Engine> TypedState<T>::makeEncryptor(const std::shared_ptr<const State> &self, size_t tableLimit) const {
+    auto engine = std::make_shared<TypedEncryptor<T>>();
+    engine->keyLength = privateKey.size();
+    engine->elementWidth = elementWidth;
+    engine->key = std::static_pointer_cast<const TypedState<T>>(self);
+    engine->table = buildEncryptionTable(publicValues, tableLimit);
+    return engine;
+}
+
+template<typename T>
+decode_table_t TypedState<T>::getDecodeTable(size_t limit, ThreadPool *pool) const {
+    if (decodeTable.patterns != nullptr && widest_t(decodeTable.size) == q && decodeTable.size <= limit / sizeof(uint32_t))
+        return decodeTable;
+    if (!fitsDecodeTable(privateValues.size(), narrowQ, limit))
+        return {privateValues.size(), 0, nullptr, nullptr};
+    if (pool != nullptr)
+        return buildDecodeTable(privateValues, narrowQ, *pool);
+    ThreadPool single(1);
+    return buildDecodeTable(privateValues, narrowQ, single);
+}
+
+template<typename T>
+std::shared_ptr<const Decryptor::Engine> TypedState<T>::makeDecryptor(const std::shared_ptr<const State> &self, size_t decodeTableLimit, decomposition_t decomposition, ThreadPool *pool) const {
+    auto engine = std::make_shared<TypedDecryptor<T>>();
+    engine->keyLength = privateKey.size();
+    engine->elementWidth = elementWidth;
+    engine->key = std::static_pointer_cast<const TypedState<T>>(self);
+    engine->keyIndex = buildKeyIndex(privateValues, decomposition);
+    engine->decodeTable = getDecodeTable(decodeTableLimit, pool);
+    engine->invertedP = makeShoupMultiplier(narrowInvertedP, narrowQ);
+    return engine;
+}
+
+template<typename T>
+int TypedState<T>::save(const std::string &fileName, size_t decodeTableLimit, ThreadPool *pool) const {
+    T narrowP = narrowNumber<T>(p);
+    return writeKeyring(fileName, narrowP, narrowQ, narrowInvertedP, privateValues, publicValues, getDecodeTable(decodeTableLimit, pool));
+}
+
+// Fills in everything but the decode table from the values of the key.
+template<typename T>
+static std::shared_ptr<TypedState<T>> makeState(const std::vector<widest_t> &privateKey, const widest_t &p, const widest_t &q) {
+    auto state = std::make_shared<TypedState<T>>();
+    state->privateValues = narrowKey<T>(privateKey);
+    state->narrowQ = narrowNumber<T>(q);
+    state->p = p;
+    state->q = q;
+    state->privateKey = privateKey;
+    state->decodeTable = {privateKey.size(), 0, nullptr, nullptr};
+    return state;
+}
+
+// The public key and its width, once the values of the public key are known.
+template<typename T>
+static void setPublicKey(TypedState<T> &state, std::vector<T> publicValues) {
+    widest_t maxBlockSum = 0;
+    state.publicKey.clear();
+    for (T x : publicValues) {
+        state.publicKey.push_back(widenNumber(x));
+        maxBlockSum += widenNumber(x);
+    }
+    state.publicValues = std::move(publicValues);
+    state.elementWidth = getElementWidth(maxBlockSum);
+}
+
+int KeyPair::create(const std::vector<widest_t> &privateKey, const widest_t &p, const widest_t &q) {
+    if (!relativelyPrime(p, q))
+        return 1;
+    widest_t sum;
+    if (privateKey.empty() || !isSuperincreasing(privateKey, sum))
+        return 2;
+    if (q <= sum)
+        return 3;
+    std::shared_ptr<const State> created;
+    if (!withNumberType(q, privateKey.size(), [&](auto type) {
+        typedef decltype(type) T;
+        auto state = makeState<T>(privateKey, p % q, q);
+        T narrowP = narrowNumber<T>(state->p);
+        setPublicKey(*state, makePublicKey(state->privateValues, narrowP, state->narrowQ));
+        state->narrowInvertedP = getInvertedP(narrowP, state->narrowQ);
+        state->invertedP = widenNumber(state->narrowInvertedP);
+        created = state;
+    }))
+        return 4;
+    state = created;
+    return 0;
+}
+
+int KeyPair::load(const std::string &fileName, bool verify) {
+    keyring_t keyring;
+    int ret = mapKeyring(fileName, verify, keyring);
+    if (ret != 0)
+        return ret;
+    std::shared_ptr<const State> loaded;
+    if (!withNumberType(keyring.q, keyring.privateKey.size(), [&](auto type) {
+        typedef decltype(type) T;
+        auto state = makeState<T>(keyring.privateKey, keyring.p, keyring.q);
+        setPublicKey(*state, narrowKey<T>(keyring.publicKey));
+        state->narrowInvertedP = narrowNumber<T>(keyring.invertedP);
+        state->invertedP = keyring.invertedP;
+        state->decodeTable = keyring.decodeTable;
+        loaded = state;
+    }))
+        return 2;
+    state = loaded;
+    return 0;
+}
+
+int KeyPair::save(const std::string &fileName, size_t decodeTableLimit, ThreadPool *pool) const {
+    return state->save(fileName, decodeTableLimit, pool);
+}
+
+bool KeyPair::empty() const {
+    return state == nullptr;
+}
+
+size_t KeyPair::length() const {
+    return state->privateKey.size();
+}
+
+uint8_t KeyPair::elementWidth() const {
+    return state->elementWidth;
+}
+
+size_t KeyPair::bytesPerPeriod() const {
+    return std::lcm(length(), (size_t)8) / 8;
+}
+
+const widest_t &KeyPair::p() const {
+    return state->p;
+}
+
+const widest_t &KeyPair::q() const {
+    return state->q;
+}
+
+const widest_t &KeyPair::invertedP() const {
+    return state->invertedP;
+}
+
+const std::vector<widest_t> &KeyPair::privateKey() const {
+    return state->privateKey;
+}
+
+const std::vector<widest_t> &KeyPair::publicKey() const {
+    return state->publicKey;
+}
+
+Encryptor::Encryptor(const KeyPair &key, size_t tableLimit, ThreadPool *pool)
+    : engine(key.state->makeEncryptor(key.state, tableLimit)), pool(pool) {
+}
+
+size_t Encryptor::maxEncryptedSize(size_t size) const {
+    return (size * 8 + engine->keyLength - 1) / engine->keyLength * engine->elementWidth;
+}
+
+size_t Encryptor::encrypt(const uint8_t *data, size_t size, uint8_t *out) const {
+    return engine->encrypt(data, size, out, pool);
+}
+
+Decryptor::Decryptor(const KeyPair &key, size_t decodeTableLimit, decomposition_t decomposition, ThreadPool *pool)
+    : engine(key.state->makeDecryptor(key.state, decodeTableLimit, decomposition, pool)), pool(pool) {
+}
+
+size_t Decryptor::maxDecryptedSize(size_t count) const {
+    return (count * engine->keyLength + 7) / 8;
+}
+
+size_t Decryptor::decrypt(const uint8_t *blocks, size_t count, uint8_t *out) const {
+    std::fill(out, out + maxDecryptedSize(count), 0);
+    engine->decrypt(blocks, count, out, pool);
+    return count * engine->keyLength / 8;
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+#include "biguint.hpp"
+#include "decryption.hpp"
+#include "thread_pool.hpp"
+
+// The interface of libknapsack, which holds no global state. A KeyPair is
+// immutable once it has been created, and so are the Encryptors and the
+// Decryptors made from it, so any number of them can be used by any number
+// of threads at once. Each of them may be given a pool of threads to split
+// the work among (nullptr = the calling thread only).
+//
+// The encrypted blocks are passed around as they are stored in a container:
+// little-endian numbers of KeyPair::elementWidth() bytes each.
+
+const size_t DEFAULT_ENCRYPTION_TABLE_LIMIT = 16777216;
+const size_t DEFAULT_DECODE_TABLE_LIMIT = 16777216;
+
+class KeyPair {
+public:
+    // Validates the private key, p and q and derives the public key and p^(-1)
+    // from them. Returns 0 on success, 1 if p and q are not relatively prime,
+    // 2 if the private key is empty or not super-increasing, 3 if q is not
+    // greater than the sum of its values and 4 if q is too large for a key
+    // of that length.
+    int create(const std::vector<widest_t> &privateKey, const widest_t &p, const widest_t &q);
+
+    // Takes the key from a keyring (see keyring.hpp) as it is. Returns the
+    // codes of mapKeyring(), or 2 if the values don't fit together.
+    int load(const std::string &fileName, bool verify);
+
+    // Writes the key into a keyring along with the decode table if it takes
+    // up no more than decodeTableLimit bytes. Returns 0 on success, 1 if the
+    // keyring couldn't be written.
+    int save(const std::string &fileName, size_t decodeTableLimit = DEFAULT_DECODE_TABLE_LIMIT, ThreadPool *pool = nullptr) const;
+
+    bool empty() const;
+    size_t length() const;
+    // Number of bytes each encrypted block is stored in.
+    uint8_t elementWidth() const;
+    // Chunks of data encrypted one by one must be multiples of this many
+    // bytes (but the last one), so that they end at a block boundary.
+    size_t bytesPerPeriod() const;
+    const widest_t &p() const;
+    const widest_t &q() const;
+    const widest_t &invertedP() const;
+    const std::vector<widest_t> &privateKey() const;
+    const std::vector<widest_t> &publicKey() const;
+
+    struct State;
+
+private:
+    std::shared_ptr<const State> state;
+
+    friend class Encryptor;
+    friend class Decryptor;
+};
+
+class Encryptor {
+public:
+    // The tables used to encrypt a byte at a time are left out if they
+    // would take up more than tableLimit bytes. The key must not be empty.
+    explicit Encryptor(const KeyPair &key, size_t tableLimit = DEFAULT_ENCRYPTION_TABLE_LIMIT, ThreadPool *pool = nullptr);
+
+    // The size of the buffer encrypt() needs for size bytes of data.
+    size_t maxEncryptedSize(size_t size) const;
+
+    // Encrypts size bytes of data starting at a block boundary and returns the
+    // number of blocks written into out. The last incomplete block is written
+    // only if its sum is not zero.
+    size_t encrypt(const uint8_t *data, size_t size, uint8_t *out) const;
+
+    struct Engine;
+
+private:
+    std::shared_ptr<const Engine> engine;
+    ThreadPool *pool;
+};
+
+class Decryptor {
+public:
+    // The table used to decrypt blocks by a lookup is left out if it would take
+    // up more than decodeTableLimit bytes. The key must not be empty.
+    explicit Decryptor(const KeyPair &key, size_t decodeTableLimit = DEFAULT_DECODE_TABLE_LIMIT, decomposition_t decomposition = DECOMPOSITION_AUTO, ThreadPool *pool = nullptr);
+
+    // The size of the buffer decrypt() needs for count blocks.
+    size_t maxDecryptedSize(size_t count) const;
+
+    // Decrypts count blocks and returns the number of whole bytes written
+    // into out. The bits of the last incomplete byte (if there are any) are
+    // written too, the rest of the byte being zero.
+    size_t decrypt(const uint8_t *blocks, size_t count, uint8_t *out) const;
+
+    struct Engine;
+
+private:
+    std::shared_ptr<const Engine> engine;
+    ThreadPool *pool;
+};
@@ -1,13 +1,31 @@
 #include <iostream>
 #include <vector>
 #include <fstream>
-#include <cmath>
 #include <iomanip>
 #include <unordered_map>
+#include <memory>
+#include <filesystem>
+#include <numeric>
+#include <random>
+#include <atomic>
+#include <csignal>
+#include <mutex>
+#include <algorithm>
 
 #include "cxxopts.hpp"
+#include "knapsack.hpp"
+#include "thread_pool.hpp"
+#include "container.hpp"
+#include "biguint.hpp"
+#include "keys.hpp"
+#include "output.hpp"
+#include "stats.hpp"
+#include "keygen.hpp"
+#include "server.hpp"
+#include "pipeline.hpp"
+#include "file_io.hpp"
+#include "hex.hpp"
 
-#define KEY_FILE_SEPARATOR ','
 #define DEBUG(msg) (arg["verbose"].as<bool>() && std::cout << msg << std::flush)
 
 const std::string PREFIX_BIN_FILE = "knapsack_";
@@ -15,395 +33,822 @@ const std::string PREFIX_BIN_FILE = "knapsack_";
 cxxopts::ParseResult arg;
 cxxopts::Options options("./knapsack <input> <p> <q>", "KIV/BIT task 4 - knapsack encryption/decryption");
 
-std::string inputFileName;
-std::string ouputFileName;
+// The state of a single run of the program, which is made by main() and
+// passed to the functions of the mode run.
+// Everything but the handling of the files and the options is done by
+// libknapsack (see knapsack.hpp). The encrypted blocks are stored as
+// little-endian numbers of key.elementWidth() bytes each.
+// The input file and the binary files written are mapped into memory (see
+// file_io.hpp), so the data is encrypted and decrypted right in them.
+struct run_state_t {
+    std::string inputFileName;
+    std::string ouputFileName;
 
-std::vector<uint8_t> inputData;
-std::vector<int> privateKey;
-std::vector<int> publicKey;
-std::vector<int> encryptedData;
-std::vector<uint8_t> decryptedData;
+    MappedFile inputData;
+    std::vector<widest_t> parsedPrivateKey;
+    KeyPair key;
+    std::vector<uint8_t> encryptedData; // the blocks unless they are in containerData
+    MappedFile containerData; // the container the blocks are encrypted into
+    const uint8_t *encryptedBlocks = nullptr; // either of the two above
+    size_t blockCount = 0;
+    MappedFile decryptedData;
+    container_header_t containerHeader;
+    bool hexInput = false; // --decrypt of an output file in the hex format
 
-struct xgdc_values_t {
-    // a*x + b*y = gdc(a,b)
-    int d; // gdc(a,b)
-    int x; 
-    int y;
+    // All the sections of the output file are written by a single writer, and
+    // so is the data printed out (-p) along with std::cout.
+    OutputWriter outputFile;
+    OutputWriter printer{STDOUT_FILENO};
+
+    std::unique_ptr<ThreadPool> threadPool;
+    std::vector<phase_stats_t> stats; // see --stats
+    std::mutex statsMutex; // the stages of streamData() record their phases at once
 };
 
-int readInputFile(std::string inputFileName) {
-    DEBUG("loading the content of the input file...");
-    std::ifstream file(inputFileName, std::ios::binary);
-    if (file.fail())
-        return 1;
-    inputData = std::vector<uint8_t>(std::istreambuf_iterator<char>(file), {});
-    file.close();
-    DEBUG("OK\n");
-    return 0;
+void recordPhase(run_state_t &state, const std::string &name, timestamp_t start, uint64_t bytes = 0, uint64_t blocks = 0) {
+    std::lock_guard<std::mutex> lock(state.statsMutex);
+    addPhase(state.stats, name, start, bytes, blocks);
 }
 
-bool isInteger(std::string &str) {
-    for (char c : str)
-        if (!isdigit(c))
-            return false;
-    return true;
+// The same as OutputWriter::writeData(), except the time spent is recorded
+// as output formatting.
+void formatData(run_state_t &state, OutputWriter &writer, const uint8_t *data, size_t size, bool binary) {
+    auto start = phaseStart();
+    uint64_t begin = writer.position();
+    writer.writeData(data, size, binary, arg["hex-padding"].as<uint8_t>());
+    recordPhase(state, "output formatting", start, writer.position() - begin);
 }
 
-std::unordered_set<int> primeFactors(int n) {
-    std::unordered_set<int> factors;
-    while ((n & 1) == 0) {
-        factors.insert(2);
-        n >>= 1;
-    }
-    for (int i = 3; i <= sqrt(n); i += 2) 
-        while (n % i == 0) {
-            factors.insert(i);
-            n /= i;
-        }
-    if (n > 2)
-        factors.insert(n);
-    return factors;
+// The same as OutputWriter::writeBlocks(), except the time spent is recorded
+// as output formatting.
+void formatBlocks(run_state_t &state, OutputWriter &writer, const uint8_t *blocks, size_t count) {
+    auto start = phaseStart();
+    uint64_t begin = writer.position();
+    writer.writeBlocks(blocks, count, state.key.elementWidth(), arg["hex-padding"].as<uint8_t>());
+    recordPhase(state, "output formatting", start, writer.position() - begin, count);
 }
 
-bool relativelyPrime(int p, int q) {
-    auto factors1 = primeFactors(p);
-    auto factors2 = primeFactors(q);
-    int top = std::min(factors1.size(), factors2.size());
-    auto it = factors1.begin();
+// Prints out the data, keeping it in order with what goes through std::cout.
+// The numbers printed by std::cout after the hexadecimal data (see -d) have
+// always been hexadecimal too, so std::cout is left in that state.
+void printData(run_state_t &state, const uint8_t *data, size_t size, bool binary) {
+    std::cout.flush();
+    formatData(state, state.printer, data, size, binary);
+    state.printer.flush();
+    if (binary && size > 0)
+        std::cout << std::setfill('0') << std::hex << std::uppercase;
+}
 
-    while (top--) {
-        if (*it != 1 && factors2.count(*it))
-            return false;
-        it++;
-    }
-    return true;
+void printBlocks(run_state_t &state, const uint8_t *blocks, size_t count) {
+    std::cout.flush();
+    formatBlocks(state, state.printer, blocks, count);
+    state.printer.flush();
+    if (count > 0)
+        std::cout << std::setfill('0') << std::hex << std::uppercase;
 }
 
-std::string strip(const std::string &str) {
-    auto start_it = str.begin();
-    auto end_it = str.rbegin();
+io_backend_t getIoBackend() {
+    return arg["io"].as<std::string>() == "uring" && isUringSupported() ? IO_BACKEND_URING : IO_BACKEND_BLOCKING;
+}
 
-    while (std::isspace(*start_it))
-        ++start_it;
-    while (std::isspace(*end_it))
-        ++end_it;
-    return std::string(start_it, end_it.base());
+int readInputFile(run_state_t &state, std::string fileName) {
+    DEBUG("loading the content of the input file...");
+    auto start = phaseStart();
+    if (state.inputData.open(fileName, getIoBackend()) != 0)
+        return 1;
+    recordPhase(state, "input load", start, state.inputData.size());
+    DEBUG("OK\n");
+    return 0;
 }
 
-std::vector<std::string> split(std::string& str, char separator) {
-    str = strip(str);
-    std::vector<std::string> tokens;
-    std::stringstream ss(str);
-    std::string token;
-    while (getline(ss, token, separator)) {
-        if (token.length() > 0 && std::isspace(token[0]))
-            token = strip(token);
-        if (token != "")
-            tokens.push_back(token);
+// Returns 0 on success, 1 if the file can't be read, 2 if it is not
+// a container and 3 if the container is broken.
+int readContainerFile(run_state_t &state, std::string fileName) {
+    DEBUG("loading the header of the container...");
+    auto start = phaseStart();
+    std::ifstream file(fileName, std::ios::binary);
+    if (file.fail())
+        return 1;
+    int ret = readContainerHeader(file, state.containerHeader);
+    if (ret != 0)
+        return ret + 1;
+    file.close();
+    recordPhase(state, "input load", start, CONTAINER_HEADER_SIZE);
+    DEBUG("OK\n");
+    return 0;
+}
+
+// Appends the zero block the encryption leaves out at the end of the data
+// to the count blocks, given the blocks of the container read so far.
+void restoreLastBlock(const container_header_t &header, std::vector<uint8_t> &blocks, size_t &count, uint64_t blocksRead) {
+    if (blocksRead == header.blockCount && header.blockCount * header.keyLength < header.bitLength) {
+        blocks.resize((count + 1) * header.elementWidth, 0);
+        count++;
     }
-    return tokens;
 }
 
-int readPrivateKey(std::string fileName) {
+int readContainerData(run_state_t &state, std::string fileName) {
+    DEBUG("loading the encrypted data from the container...");
+    auto start = phaseStart();
+    state.encryptedData.resize(state.containerHeader.blockCount * state.containerHeader.elementWidth);
+    if (readFile(fileName, CONTAINER_HEADER_SIZE, state.encryptedData.data(), state.encryptedData.size(), getIoBackend()) != 0)
+        return 1;
+    state.blockCount = state.containerHeader.blockCount;
+    restoreLastBlock(state.containerHeader, state.encryptedData, state.blockCount, state.blockCount);
+    state.encryptedBlocks = state.encryptedData.data();
+    recordPhase(state, "input load", start, state.containerHeader.blockCount * state.containerHeader.elementWidth, state.blockCount);
+    DEBUG("OK\n");
+    return 0;
+}
+
+// Parses the encrypted data off the first line of an output file in the hex
+// format. Returns 1 if the file can't be read, 2 if it isn't in the format
+// and 3 if the numbers don't fit the key.
+int readHexData(run_state_t &state, std::string fileName) {
+    DEBUG("parsing the encrypted data in the hex format...");
+    auto start = phaseStart();
+    MappedFile file;
+    if (file.open(fileName, getIoBackend()) != 0)
+        return 1;
+    int ret = parseHex((const char *)file.data(), file.size(), state.key.elementWidth(), state.encryptedData, state.blockCount);
+    if (ret != 0)
+        return ret + 1;
+    state.encryptedBlocks = state.encryptedData.data();
+    state.containerHeader = {state.key.elementWidth(), (uint32_t)state.key.length(), (uint64_t)state.blockCount * state.key.length(), state.blockCount};
+    recordPhase(state, "input load", start, file.size(), state.blockCount);
+    DEBUG("OK\n");
+    return 0;
+}
+
+int readPrivateKey(run_state_t &state, std::string fileName) {
     DEBUG("reading the private key from '");
     DEBUG(fileName);
     DEBUG("'...");
 
+    auto start = phaseStart();
     std::ifstream file(fileName);
     if (file.fail())
         return 1;
     std::string str((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
     file.close();
 
-    auto tokens = split(str, KEY_FILE_SEPARATOR);
-    for (auto token : tokens) {
-        if (!isInteger(token))
-            return 2;
-        privateKey.push_back(atoi(token.c_str()));
-    }
+    int ret = parseKey(str, state.parsedPrivateKey);
+    if (ret != 0)
+        return ret + 1;
+    recordPhase(state, "key parsing", start, str.size());
     DEBUG("OK\n");
     return 0;
 }
 
-int isSuperincreasing(std::vector<int> &seq) {
-    int sum = 0;
-    for (int i = 0; i < (int)seq.size(); i++) {
-        if (i == 0) {
-            sum += seq[i];
-            continue;
-        } else {
-            if (seq[i] < seq[i-1] || seq[i] < sum)
-                return -1;
-            sum += seq[i];
-        }
-    }
-    return sum;
+// Maps the keyring, whose values have been validated when it was created.
+// Returns 1 (having printed out why) if it can't be used.
+int readKeyring(run_state_t &state, std::string fileName, KeyPair &keyPair) {
+    DEBUG("mapping the keyring '");
+    DEBUG(fileName);
+    DEBUG("'...");
+    auto start = phaseStart();
+    int ret = keyPair.load(fileName, !arg["skip-keyring-checksum"].as<bool>());
+    if (ret == 1)
+        std::cout << "'" << fileName << "' doesn't exist!\n";
+    else if (ret == 2)
+        std::cout << "'" << fileName << "' is not a valid keyring!\n";
+    else if (ret == 3)
+        std::cout << "the checksum of the keyring doesn't match!\n";
+    if (ret != 0)
+        return 1;
+    recordPhase(state, "key parsing", start, std::filesystem::file_size(fileName));
+    DEBUG("OK\n");
+    return 0;
 }
 
-// (a * b) % c
-int mult(int a, int b, int c) {
-    if (a == 0 || b == 0)
-        return 0;
-    if (a == 1)
-        return b;
-    if (b == 1)
-        return a;
-
-    int a2 = mult(a, b / 2, c);
-
-    if ((b & 1) == 0) {
-        return (a2 + a2) % c;
-    } else {
-        return ((a % c) + (a2 + a2)) % c;
-    }
+// Derives the public key and p^(-1) from the validated private key, p and q.
+// Returns 1 if q is too large for the key.
+int deriveKey(run_state_t &state, const std::vector<widest_t> &privateKey, const widest_t &p, const widest_t &q) {
+    DEBUG("generating a public key and calculating p^(-1)...");
+    auto start = phaseStart();
+    if (state.key.create(privateKey, p, q) != 0)
+        return 1;
+    recordPhase(state, "public key generation", start);
+    DEBUG("OK (");
+    DEBUG("p^(-1)=");
+    DEBUG(state.key.invertedP());
+    DEBUG(")\n");
+    return 0;
 }
 
-void generatePublicKey(int p, int q) {
-    DEBUG("generating a public key...");
+void writePublicKey(run_state_t &state) {
+    DEBUG("writing the public key into '");
+    DEBUG(arg["public-key"].as<std::string>());
+    DEBUG("'...");
+    auto start = phaseStart();
     std::ofstream file(arg["public-key"].as<std::string>());
-    for (int i = 0; i < (int)privateKey.size(); i++) {
-        publicKey.push_back(mult(p, privateKey[i], q));
-        file << *publicKey.rbegin();
-        if (i < (int)privateKey.size() - 1)
+    const std::vector<widest_t> &publicKey = state.key.publicKey();
+    for (int i = 0; i < (int)publicKey.size(); i++) {
+        file << publicKey[i];
+        if (i < (int)publicKey.size() - 1)
             file << ",";
     }
     file.close();
+    recordPhase(state, "public key generation", start);
     DEBUG("OK\n");
 }
 
-template<typename T>
-void appendDataToOutputFile(std::vector<T> data, bool binary, std::string msg) {
+// Adds a section to the output file: what format() writes followed by a new line.
+template<typename F>
+void writeSection(run_state_t &state, const std::string &msg, F format) {
     DEBUG("adding data into the output file (");
     DEBUG(msg);
     DEBUG(")...");
-    std::ofstream file(arg["output"].as<std::string>(), std::ios::app);
-    for (auto x : data) {
-        if (binary)
-            file << std::setfill('0') << std::setw(arg["hex-padding"].as<uint8_t>()) << std::right << std::hex << std::uppercase << (int)x << " ";
-        else
-            file << (char)x;
-    }
-    file << '\n';
-    file.close();
+    format(state.outputFile);
+    state.outputFile.put('\n');
     DEBUG("OK\n");
 }
 
-void removeOutputFile() {
-    DEBUG("removing output file...");
-    remove(arg["output"].as<std::string>().c_str());
+// Truncates the output file (or creates it) for the sections to be written
+// into. Returns 1 if it couldn't be created.
+int createOutputFile(run_state_t &state) {
+    DEBUG("creating the output file...");
+    if (state.outputFile.open(arg["output"].as<std::string>()) != 0) {
+        std::cout << "the output file '" << arg["output"].as<std::string>() << "' couldn't be created!\n";
+        return 1;
+    }
     DEBUG("OK\n");
+    return 0;
 }
 
-int getBit(int index) {
+// Writes out what is left of the output file and of the data printed out.
+// Returns 1 if some of them couldn't be written.
+int closeOutputFile(run_state_t &state) {
+    if (state.outputFile.close() != 0) {
+        std::cout << "the output file '" << arg["output"].as<std::string>() << "' couldn't be written!\n";
+        return 1;
+    }
+    if (!state.printer.flush()) {
+        std::cerr << "the data couldn't be printed out!\n";
+        return 1;
+    }
+    return 0;
+}
+
+int getBit(run_state_t &state, int index) {
     int p = index / 8;
     int b = index % 8;
-    if (p >= (int)inputData.size())
+    if (p >= (int)state.inputData.size())
         return -1;
-    return (inputData[p] >> (7 - b)) & 1;
+    return (state.inputData[p] >> (7 - b)) & 1;
+}
+
+widest_t getBlock(const KeyPair &key, const uint8_t *blocks, size_t i) {
+    return loadLittleEndian<widest_t>(&blocks[i * key.elementWidth()], key.elementWidth());
 }
 
-void encryptData() {
+container_header_t makeContainerHeader(const KeyPair &key, uint64_t bitLength) {
+    return {key.elementWidth(), (uint32_t)key.length(), bitLength, 0};
+}
+
+// The blocks have been encrypted straight into the container, so it is only
+// given its header and cut down to the blocks written. Returns 1 if it
+// couldn't be written.
+int createContainerFile(run_state_t &state) {
+    DEBUG("creating a container of the encrypted data '");
+    DEBUG(arg["container"].as<std::string>());
+    DEBUG("'...");
+    auto start = phaseStart();
+    auto header = makeContainerHeader(state.key, state.inputData.size() * 8);
+    header.blockCount = state.blockCount;
+
+    storeContainerHeader(state.containerData.data(), header);
+    if (state.containerData.truncate(CONTAINER_HEADER_SIZE + state.blockCount * header.elementWidth) != 0)
+        return 1;
+    recordPhase(state, "binary file writing", start, CONTAINER_HEADER_SIZE + header.blockCount * header.elementWidth, header.blockCount);
+    DEBUG("OK\n");
+    return 0;
+}
+
+void printEncryptionTrace(run_state_t &state) {
+    for (int i = 0; getBit(state, i) != -1; i++) {
+        std::cout << getBit(state, i);
+        if ((i+1) % state.key.length() == 0)
+            std::cout << " | " << getBlock(state.key, state.encryptedBlocks, i / state.key.length()) << "\n";
+    }
+}
+
+// Returns 1 (having printed out why) if the container couldn't be written.
+int encryptData(run_state_t &state) {
     DEBUG("starting encrypting the input data\n");
-    int blockSum = 0;
-    int value;
-    int i = 0;
-
-    while (1) {
-        value = getBit(i);
-        if (value == -1) {
-            if (blockSum != 0)
-                encryptedData.push_back(blockSum);
-            break;
-        }
-        if (arg["debug"].as<bool>())
-            std::cout << value;
-
-        if (value == 1)
-            blockSum += publicKey[i % publicKey.size()];
-        if ((i+1) % publicKey.size() == 0) {
-            if (arg["debug"].as<bool>())
-                std::cout << " | " << blockSum << "\n";
-            encryptedData.push_back(blockSum);
-            blockSum = 0;
+    auto start = phaseStart();
+    Encryptor encryptor(state.key, arg["encryption-table-limit"].as<size_t>(), state.threadPool.get());
+    bool binaryFormat = arg["format"].as<std::string>() == "binary";
+    std::string containerFileName = arg["container"].as<std::string>();
+    size_t size = encryptor.maxEncryptedSize(state.inputData.size());
+    uint8_t *blocks;
+    if (binaryFormat) {
+        if (state.containerData.create(containerFileName, CONTAINER_HEADER_SIZE + size) != 0) {
+            std::cout << "the container '" << containerFileName << "' couldn't be created!\n";
+            return 1;
         }
-        i++;
+        blocks = state.containerData.data() + CONTAINER_HEADER_SIZE;
+    } else {
+        state.encryptedData.resize(size);
+        blocks = state.encryptedData.data();
     }
+    state.blockCount = encryptor.encrypt(state.inputData.data(), state.inputData.size(), blocks);
+    state.encryptedBlocks = blocks;
+    recordPhase(state, "encryption", start, state.inputData.size(), state.blockCount);
+
+    if (arg["debug"].as<bool>())
+        printEncryptionTrace(state);
     if (arg["print"].as<bool>()) {
         std::cout << "encrypted data (HEX): ";
-        for (int x : encryptedData)
-            std::cout << std::setfill('0') << std::setw(arg["hex-padding"].as<uint8_t>()) << std::right << std::hex << std::uppercase << x << " ";
+        printBlocks(state, state.encryptedBlocks, state.blockCount);
         std::cout << "\n";
     }
-    removeOutputFile();
-    appendDataToOutputFile(encryptedData, true, "encrypted data");
-}
-
-xgdc_values_t xgdc(int a, int b) {
-    if (b == 0)
-        return {a, 1, 0};
-    else {
-        auto vals = xgdc(b, a % b);
-        return {vals.d, vals.y, vals.x - vals.y * (a / b)};
+    if (createOutputFile(state) != 0)
+        return 1;
+    if (binaryFormat) {
+        if (createContainerFile(state) != 0) {
+            std::cout << "the container '" << containerFileName << "' couldn't be written!\n";
+            return 1;
+        }
+        state.outputFile.write("INFO: The encrypted data can be found in '" + containerFileName + "'\n");
     }
+    else
+        writeSection(state, "encrypted data", [&](OutputWriter &writer) {
+            formatBlocks(state, writer, state.encryptedBlocks, state.blockCount);
+        });
+    return 0;
 }
 
-int getInvertedP(int p, int q) {
-    auto values = xgdc(p, q);
-    if (values.x >= 0)
-        return values.x;
-    return q + values.x;
-}
-
-std::vector<int> findValuesInPrivateKey(int n) {
-    std::vector<int> bin(privateKey.size(), 0);
-    for (int i = privateKey.size() - 1; i >= 0; i--)
-        if (privateKey[i] <= n) {
-            n -= privateKey[i];
-            bin[i] = 1;
-            if (n == 0)
-                return bin;
-        }
-    return bin; 
+std::string getBinaryOutputFileName(run_state_t &state) {
+    size_t lastPosOfSlash = state.inputFileName.find_last_of('/');
+    if (lastPosOfSlash != std::string::npos)
+        return PREFIX_BIN_FILE + state.inputFileName.substr(lastPosOfSlash + 1, state.inputFileName.length());
+    return PREFIX_BIN_FILE + state.inputFileName;
 }
 
-void createBinaryOutputFile() {
-    size_t lastPosOfSlash = inputFileName.find_last_of('/');
-    ouputFileName = PREFIX_BIN_FILE;
-    if (lastPosOfSlash != std::string::npos)
-        ouputFileName += inputFileName.substr(lastPosOfSlash + 1, inputFileName.length());
-    else
-        ouputFileName += inputFileName;
+// The data has been decrypted straight into the file unless it couldn't be
+// created up front. Returns 1 if the file couldn't be written.
+int createBinaryOutputFile(run_state_t &state) {
+    state.ouputFileName = getBinaryOutputFileName(state);
 
     DEBUG("creating a binary output file '");
-    DEBUG(ouputFileName);
+    DEBUG(state.ouputFileName);
     DEBUG("'...");
 
-    std::ofstream output(ouputFileName, std::ios::binary);
-    output.write((const char *)&decryptedData[0], decryptedData.size());
-    output.close();
+    auto start = phaseStart();
+    if (!state.decryptedData.isCreated() && writeFile(state.ouputFileName, state.decryptedData.data(), state.decryptedData.size(), false, getIoBackend()) != 0)
+        return 1;
+    recordPhase(state, "binary file writing", start, state.decryptedData.size());
     DEBUG("OK\n");
+    return 0;
+}
+
+void printDecryptionTrace(run_state_t &state, const uint8_t *blocks, size_t count, const uint8_t *bits) {
+    size_t n = state.key.length();
+    for (size_t i = 0; i < count; i++) {
+        widest_t x = getBlock(state.key, blocks, i);
+        std::cout << "(" << state.key.invertedP() << " * " << x << ") % " << state.key.q() << " = " << mult(state.key.invertedP(), x, state.key.q()) << " | ";
+        for (size_t bit = i * n; bit < (i + 1) * n; bit++)
+            std::cout << ((bits[bit / 8] >> (7 - bit % 8)) & 1);
+        std::cout << "\n";
+    }
 }
 
-void decryptData(int p, int q) {
+decomposition_t getDecomposition() {
+    std::string decomposition = arg["decomposition"].as<std::string>();
+    return decomposition == "linear" ? DECOMPOSITION_LINEAR : decomposition == "jump" ? DECOMPOSITION_JUMP : DECOMPOSITION_AUTO;
+}
+
+Decryptor makeDecryptor(run_state_t &state) {
+    DEBUG("preparing the decryption...");
+    Decryptor decryptor(state.key, arg["decode-table-limit"].as<size_t>(), getDecomposition(), state.threadPool.get());
+    DEBUG("OK\n");
+    return decryptor;
+}
+
+// Returns 1 (having printed out why) if the binary output file couldn't be written.
+int decryptData(run_state_t &state) {
     DEBUG("starting decrypting the input data\n");
-    DEBUG("calculating p^(-1) using the extended euclidean algorithm...");
-    int invertedP = getInvertedP(p, q);
-    DEBUG("OK (");
-    DEBUG("p^(-1)=");
-    DEBUG(invertedP);
-    DEBUG(")\n");
+    auto start = phaseStart();
+    Decryptor decryptor = makeDecryptor(state);
+    // the binary output file is known to take up (at most) this many bytes
+    size_t size = decryptor.maxDecryptedSize(state.blockCount);
+    if (!arg["binary"].as<bool>() || state.decryptedData.create(getBinaryOutputFileName(state), size) != 0)
+        state.decryptedData.allocate(size);
+    size = decryptor.decrypt(state.encryptedBlocks, state.blockCount, state.decryptedData.data());
+    if (arg["debug"].as<bool>())
+        printDecryptionTrace(state, state.encryptedBlocks, state.blockCount, state.decryptedData.data());
+    recordPhase(state, "decryption", start, size, state.blockCount);
 
-    std::string originalData = "";
-    for (int x : encryptedData) {
-        int val = mult(invertedP, x, q);
-        if (arg["debug"].as<bool>())
-            std::cout << "(" << invertedP << " * " << x << ") % " << q << " = " << val << " | ";
+    // the container knows the exact length of the original data, while the
+    // hex format only tells that it ends within the last block, so the zero
+    // bytes past the start of the block are taken for padding
+    if (state.hexInput && state.blockCount > 0) {
+        size_t least = std::min(size, (state.blockCount - 1) * state.key.length() / 8 + 1);
+        while (size > least && state.decryptedData[size - 1] == 0)
+            size--;
+    } else if (arg["decrypt"].as<bool>())
+        size = std::min(size, (size_t)(state.containerHeader.bitLength / 8));
+    bool truncated = state.decryptedData.truncate(size) == 0;
 
-        auto bin = findValuesInPrivateKey(val);
-        for (int b : bin) {
-            originalData += std::to_string(b);
-            if (arg["debug"].as<bool>())
-                std::cout << b;
-        }
-        if (arg["debug"].as<bool>())
-            std::cout << "\n";
-    }
-    uint8_t block = 0;
-    int pos = 7;
-    for (int i = 0; i < (int)originalData.length(); i++) {
-        block |= (originalData[i] == '1') << pos;
-        if (pos == 0) {
-            decryptedData.push_back(block);
-            pos = 7;
-            block = 0;
-        } else {
-            pos--;
-        }
-    }
     if (arg["print"].as<bool>()) {
         std::cout << "decrypted data (HEX): ";
-        for (int x : decryptedData)
-            std::cout << std::setfill('0') << std::setw(arg["hex-padding"].as<uint8_t>()) << std::right << std::hex << std::uppercase << x << " ";
+        printData(state, state.decryptedData.data(), state.decryptedData.size(), true);
         std::cout << "\n";
 
         if (!arg["binary"].as<bool>()) {
             std::cout << "decrypted data (ASCII): ";
-            for (int x : decryptedData)
-                std::cout << (char)x;
+            printData(state, state.decryptedData.data(), state.decryptedData.size(), false);
             std::cout << "\n";
         }
     }
-    appendDataToOutputFile(decryptedData, true, "decrypted data");
+    writeSection(state, "decrypted data", [&](OutputWriter &writer) {
+        formatData(state, writer, state.decryptedData.data(), state.decryptedData.size(), true);
+    });
     if (arg["binary"].as<bool>()) {
-        createBinaryOutputFile();
-        std::ofstream file(arg["output"].as<std::string>(), std::ios::app);
-        file << "INFO: The decrypted content of the file can be found in '" << ouputFileName << "'\n";
+        if (!truncated || createBinaryOutputFile(state) != 0) {
+            std::cout << "the binary output file '" << getBinaryOutputFileName(state) << "' couldn't be written!\n";
+            return 1;
+        }
+        state.outputFile.write("INFO: The decrypted content of the file can be found in '" + state.ouputFileName + "'\n");
     }
     else
-        appendDataToOutputFile(decryptedData, false, "decrypted plain text");
+        writeSection(state, "decrypted plain text", [&](OutputWriter &writer) {
+            formatData(state, writer, state.decryptedData.data(), state.decryptedData.size(), false);
+        });
+    return 0;
 }
 
-int main(int argc, char *argv[]) {
-    options.add_options()
-        ("v,verbose", "print out info as the program proceeds", cxxopts::value<bool>()->default_value("false"))
-        ("o,output", "name of the output file", cxxopts::value<std::string>()->default_value("output.txt"))
-        ("b,binary", "the input file will be treated as a binary file", cxxopts::value<bool>()->default_value("false"))
-        ("k,private-key", "file containing the private key", cxxopts::value<std::string>()->default_value("keys/private_key_1.txt"))
-        ("l,public-key", "file containing the private key", cxxopts::value<std::string>()->default_value("public_key.txt"))
-        ("p,print", "print out the binary data as well as the decrypted text", cxxopts::value<bool>()->default_value("false"))
-        ("d,debug", "print out step-by-step the process of encryption/decryption", cxxopts::value<bool>()->default_value("false"))
-        ("x,hex-padding", "set number of digits to be printed out in a hexadecimal format", cxxopts::value<uint8_t>()->default_value("5"))
-        ("h,help", "print help")
-    ;
-    arg = options.parse(argc, argv);
-    if (arg.count("help")) {
-        std::cout << options.help() << std::endl;
+// Reads the first size bytes of the file in chunks of the given size and
+// passes them to process. The time spent reading is recorded as the given
+// phase. Returns 1 if the file couldn't be read.
+template<typename F>
+int readInChunks(run_state_t &state, const std::string &fileName, uint64_t size, size_t chunkSize, const std::string &phase, F process) {
+    std::vector<uint8_t> chunk;
+    for (uint64_t offset = 0; offset < size; offset += chunk.size()) {
+        auto start = phaseStart();
+        chunk.resize(std::min((uint64_t)chunkSize, size - offset));
+        if (readFile(fileName, offset, chunk.data(), chunk.size(), getIoBackend()) != 0)
+            return 1;
+        recordPhase(state, phase, start, chunk.size());
+        process(chunk);
+    }
+    return 0;
+}
+
+// A chunk of the data on its way through the stages of streamData().
+struct stream_chunk_t {
+    std::vector<uint8_t> data; // the plain data read in (when encrypting)
+    std::vector<uint8_t> blocks;
+    size_t blockCount = 0;
+    std::vector<uint8_t> decrypted; // including the last incomplete byte
+    size_t decryptedSize = 0;
+};
+
+// The same as encryptData() followed by decryptData(), except the data is
+// processed in chunks, so only a few chunks are held in memory at a time.
+// The chunks are read in, encrypted/decrypted and written out by the stages
+// of a pipeline (see pipeline.hpp), so the I/O overlaps with the computation.
+// The decrypted data is spooled into a file (the binary output file or
+// a temporary one) from which the remaining sections of the output are made.
+// The files are read and written a chunk at a time through the I/O backend
+// (see --io). Returns 1 (having printed out why) if the container or the
+// spool couldn't be written.
+int streamData(run_state_t &state) {
+    DEBUG("starting encrypting/decrypting the input data in chunks\n");
+    auto start = phaseStart();
+    std::unique_ptr<Encryptor> encryptor;
+    if (!arg["decrypt"].as<bool>())
+        encryptor = std::make_unique<Encryptor>(state.key, arg["encryption-table-limit"].as<size_t>(), state.threadPool.get());
+    recordPhase(state, "encryption", start);
+    start = phaseStart();
+    Decryptor decryptor = makeDecryptor(state);
+    recordPhase(state, "decryption", start);
+    bool binary = arg["binary"].as<bool>();
+    bool print = arg["print"].as<bool>();
+    uint8_t width = state.key.elementWidth();
+    // every worker keeps the pool busy while the others wait for their ranges
+    size_t workers = state.threadPool->size();
+
+    // Chunks are made of whole periods, so they always end at a block boundary.
+    size_t chunkSize = std::max(arg["buffer-size"].as<size_t>(), (size_t)1);
+    chunkSize = (chunkSize + state.key.bytesPerPeriod() - 1) / state.key.bytesPerPeriod() * state.key.bytesPerPeriod();
+
+    std::string spoolFileName = binary ? getBinaryOutputFileName(state) : arg["output"].as<std::string>() + ".tmp";
+    if (createOutputFile(state) != 0)
+        return 1;
+    io_backend_t backend = getIoBackend();
+    if (writeFile(spoolFileName, nullptr, 0, false, backend) != 0) {
+        std::cout << "the file '" << spoolFileName << "' couldn't be written!\n";
+        return 1;
+    }
+
+    auto decryptChunk = [&](stream_chunk_t &chunk) {
+        auto start = phaseStart();
+        chunk.decrypted.resize(decryptor.maxDecryptedSize(chunk.blockCount));
+        chunk.decryptedSize = decryptor.decrypt(chunk.blocks.data(), chunk.blockCount, chunk.decrypted.data());
+        recordPhase(state, "decryption", start, chunk.decryptedSize, chunk.blockCount);
+    };
+
+    // Writes the decrypted chunk into the spool file. In the decrypt mode, the
+    // exact length of the original data is known, so the spool is trimmed to it.
+    uint64_t spoolSize = 0;
+    uint64_t spoolLimit = arg["decrypt"].as<bool>() ? state.containerHeader.bitLength / 8 : UINT64_MAX;
+    bool spoolFailed = false;
+    auto spoolChunk = [&](const stream_chunk_t &chunk) {
+        if (arg["debug"].as<bool>())
+            printDecryptionTrace(state, chunk.blocks.data(), chunk.blockCount, chunk.decrypted.data());
+        auto start = phaseStart();
+        size_t size = std::min((uint64_t)chunk.decryptedSize, spoolLimit - spoolSize);
+        if (writeFile(spoolFileName, spoolSize, chunk.decrypted.data(), size, backend) != 0)
+            spoolFailed = true;
+        spoolSize += size;
+        recordPhase(state, "binary file writing", start, size);
+    };
+
+    if (arg["decrypt"].as<bool>()) {
+        size_t chunkBlocks = chunkSize * 8 / state.key.length();
+        uint64_t blocksRead = 0;
+        auto readChunk = [&](stream_chunk_t &chunk) {
+            auto start = phaseStart();
+            chunk.blockCount = std::min((uint64_t)chunkBlocks, state.containerHeader.blockCount - blocksRead);
+            chunk.blocks.resize(chunk.blockCount * width);
+            if (chunk.blockCount == 0 || readFile(state.inputFileName, CONTAINER_HEADER_SIZE + blocksRead * width, chunk.blocks.data(), chunk.blocks.size(), backend) != 0)
+                return false;
+            recordPhase(state, "input load", start, chunk.blockCount * width, chunk.blockCount);
+            blocksRead += chunk.blockCount;
+            restoreLastBlock(state.containerHeader, chunk.blocks, chunk.blockCount, blocksRead);
+            return true;
+        };
+        runPipeline<stream_chunk_t>(workers, readChunk, decryptChunk, spoolChunk);
+    } else {
+        bool binaryFormat = arg["format"].as<std::string>() == "binary";
+        std::string containerFileName = arg["container"].as<std::string>();
+        uint64_t inputSize = std::filesystem::file_size(state.inputFileName);
+        auto header = makeContainerHeader(state.key, inputSize * 8);
+        // the header is written at the end, once the number of blocks is known
+        uint8_t headerBytes[CONTAINER_HEADER_SIZE] = {};
+        if (binaryFormat && writeFile(containerFileName, headerBytes, CONTAINER_HEADER_SIZE, false, backend) != 0) {
+            std::cout << "the container '" << containerFileName << "' couldn't be created!\n";
+            remove(spoolFileName.c_str());
+            return 1;
+        }
+        bool containerFailed = false;
+
+        DEBUG("adding data into the output file (encrypted data)...");
+        if (print)
+            std::cout << "encrypted data (HEX): ";
+        uint64_t bytesRead = 0;
+        auto readChunk = [&](stream_chunk_t &chunk) {
+            auto start = phaseStart();
+            chunk.data.resize(std::min((uint64_t)chunkSize, inputSize - bytesRead));
+            if (chunk.data.empty() || readFile(state.inputFileName, bytesRead, chunk.data.data(), chunk.data.size(), backend) != 0)
+                return false;
+            bytesRead += chunk.data.size();
+            recordPhase(state, "input load", start, chunk.data.size());
+            return true;
+        };
+        auto encryptChunk = [&](stream_chunk_t &chunk) {
+            auto start = phaseStart();
+            chunk.blocks.resize(encryptor->maxEncryptedSize(chunk.data.size()));
+            chunk.blockCount = encryptor->encrypt(chunk.data.data(), chunk.data.size(), chunk.blocks.data());
+            recordPhase(state, "encryption", start, chunk.data.size(), chunk.blockCount);
+            decryptChunk(chunk);
+        };
+        auto writeChunk = [&](const stream_chunk_t &chunk) {
+            if (binaryFormat) {
+                auto start = phaseStart();
+                uint64_t offset = CONTAINER_HEADER_SIZE + header.blockCount * width;
+                if (writeFile(containerFileName, offset, chunk.blocks.data(), chunk.blockCount * width, backend) != 0)
+                    containerFailed = true;
+                recordPhase(state, "binary file writing", start, chunk.blockCount * width, chunk.blockCount);
+            }
+            else
+                formatBlocks(state, state.outputFile, chunk.blocks.data(), chunk.blockCount);
+            if (print)
+                printBlocks(state, chunk.blocks.data(), chunk.blockCount);
+            spoolChunk(chunk);
+            header.blockCount += chunk.blockCount;
+        };
+        runPipeline<stream_chunk_t>(workers, readChunk, encryptChunk, writeChunk);
+
+        if (binaryFormat) {
+            storeContainerHeader(headerBytes, header);
+            if (containerFailed || writeFile(containerFileName, 0, headerBytes, CONTAINER_HEADER_SIZE, backend) != 0) {
+                std::cout << "the container '" << containerFileName << "' couldn't be written!\n";
+                remove(spoolFileName.c_str());
+                return 1;
+            }
+            state.outputFile.write("INFO: The encrypted data can be found in '" + containerFileName + "'\n");
+        }
+        else
+            state.outputFile.put('\n');
+        if (print)
+            std::cout << "\n";
+        DEBUG("OK\n");
+    }
+    if (spoolFailed) {
+        std::cout << "the file '" << spoolFileName << "' couldn't be written!\n";
+        remove(spoolFileName.c_str());
+        return 1;
+    }
+
+    DEBUG("adding data into the output file (decrypted data)...");
+    if (print)
+        std::cout << "decrypted data (HEX): ";
+    int result = readInChunks(state, spoolFileName, spoolSize, chunkSize, "spool load", [&](const std::vector<uint8_t> &chunk) {
+        formatData(state, state.outputFile, chunk.data(), chunk.size(), true);
+        if (print)
+            printData(state, chunk.data(), chunk.size(), true);
+    });
+    if (result != 0) {
+        std::cout << "the file '" << spoolFileName << "' couldn't be read!\n";
+        remove(spoolFileName.c_str());
+        return 1;
+    }
+    state.outputFile.put('\n');
+    if (print)
+        std::cout << "\n";
+    DEBUG("OK\n");
+
+    if (binary) {
+        state.ouputFileName = spoolFileName;
+        state.outputFile.write("INFO: The decrypted content of the file can be found in '" + state.ouputFileName + "'\n");
         return 0;
     }
-    if (argc < 4) {
-        std::cout << "ERR: Compulsory parameters are not specified!\n";
-        std::cout << "     Run './knapsack --help'\n";
+    DEBUG("adding data into the output file (decrypted plain text)...");
+    if (print)
+        std::cout << "decrypted data (ASCII): ";
+    result = readInChunks(state, spoolFileName, spoolSize, chunkSize, "spool load", [&](const std::vector<uint8_t> &chunk) {
+        formatData(state, state.outputFile, chunk.data(), chunk.size(), false);
+        if (print)
+            printData(state, chunk.data(), chunk.size(), false);
+    });
+    if (result != 0) {
+        std::cout << "the file '" << spoolFileName << "' couldn't be read!\n";
+        remove(spoolFileName.c_str());
         return 1;
-    }    
-    inputFileName = argv[1];
-    std::string pStr = argv[2];
-    std::string qStr = argv[3];
+    }
+    state.outputFile.put('\n');
+    if (print)
+        std::cout << "\n";
+    remove(spoolFileName.c_str());
+    DEBUG("OK\n");
+    return 0;
+}
 
-    if (readInputFile(inputFileName) != 0) {
-        std::cout << "input file not found!\n";
+void reportStats(run_state_t &state) {
+    if (arg["stats"].as<bool>())
+        printStatsTable(std::cout, state.stats);
+    if (arg.count("stats-file")) {
+        std::ofstream file(arg["stats-file"].as<std::string>());
+        writeStatsJson(file, state.stats);
+    }
+}
+
+// Writes the key along with everything derived from it (the public key,
+// p^(-1) and the decode table if it fits into the limit) into a keyring.
+int createKeyringFile(run_state_t &state) {
+    std::string fileName = arg["create-keyring"].as<std::string>();
+    state.threadPool = std::make_unique<ThreadPool>(arg["threads"].as<unsigned>());
+    writePublicKey(state);
+
+    DEBUG("creating a keyring '");
+    DEBUG(fileName);
+    DEBUG("'...");
+    auto start = phaseStart();
+    if (state.key.save(fileName, arg["decode-table-limit"].as<size_t>(), state.threadPool.get()) != 0) {
+        std::cout << "the keyring '" << fileName << "' couldn't be created!\n";
+        return 1;
+    }
+    recordPhase(state, "binary file writing", start, std::filesystem::file_size(fileName));
+    DEBUG("OK\n");
+    return 0;
+}
+
+// Generates a random private key of the given length along with p and q
+// and writes both the private and the public key (or the keyring if
+// --create-keyring is given) into their files.
+int generateKeys(run_state_t &state, size_t length) {
+    std::mt19937_64 rng(arg.count("seed") ? arg["seed"].as<uint64_t>() : std::random_device()());
+    std::string fileName = arg.count("private-key") ? arg["private-key"].as<std::string>() : "private_key.txt";
+
+    if (length == 0) {
+        std::cout << "the key has to have at least one value!\n";
+        return 1;
+    }
+    DEBUG("generating a private key of ");
+    DEBUG(length);
+    DEBUG(" values, p and q...");
+    auto start = phaseStart();
+    generated_key_t generated;
+    if (generateKey(length, rng, generated) != 0) {
+        std::cout << "a key of " << length << " values is too long!\n";
+        return 1;
+    }
+    std::ofstream file(fileName);
+    for (size_t i = 0; i < generated.privateKey.size(); i++)
+        file << generated.privateKey[i] << (i + 1 < generated.privateKey.size() ? "," : "");
+    file.close();
+    recordPhase(state, "key generation", start);
+    DEBUG("OK\n");
+
+    if (deriveKey(state, generated.privateKey, generated.p, generated.q) != 0) {
+        std::cout << "a key of " << length << " values is too long!\n";
         return 1;
     }
+    if (arg.count("create-keyring")) {
+        if (createKeyringFile(state) != 0)
+            return 1;
+    } else {
+        writePublicKey(state);
+    }
+    std::cout << "private key: " << fileName << "\n";
+    std::cout << "public key: " << arg["public-key"].as<std::string>() << "\n";
+    std::cout << "p: " << generated.p << "\n";
+    std::cout << "q: " << generated.q << "\n";
+    return 0;
+}
+
+int run(run_state_t &state) {
+    if (state.hexInput) {
+        int ret = readHexData(state, state.inputFileName);
+        if (ret == 1)
+            std::cout << "input file not found!\n";
+        else if (ret == 2)
+            std::cout << "the input file is neither a container nor an output file in the hex format!\n";
+        else if (ret == 3)
+            std::cout << "the encrypted data doesn't match the values p and q!\n";
+        if (ret != 0)
+            return 1;
+    } else if (arg["decrypt"].as<bool>()) {
+        if (state.containerHeader.elementWidth != state.key.elementWidth()) {
+            std::cout << "the encrypted data doesn't match the values p and q!\n";
+            return 1;
+        }
+        if (!arg["stream"].as<bool>() && readContainerData(state, state.inputFileName) != 0) {
+            std::cout << "the input file is not a valid container!\n";
+            return 1;
+        }
+    }
+
+    state.threadPool = std::make_unique<ThreadPool>(arg["threads"].as<unsigned>());
+    if (!arg.count("keyring"))
+        writePublicKey(state);
+    // the hex format is parsed as a whole
+    if (arg["stream"].as<bool>() && !state.hexInput) {
+        if (streamData(state) != 0)
+            return 1;
+        return closeOutputFile(state);
+    }
+    if (arg["decrypt"].as<bool>()) {
+        if (createOutputFile(state) != 0)
+            return 1;
+    }
+    else if (encryptData(state) != 0)
+        return 1;
+    if (decryptData(state) != 0)
+        return 1;
+    return closeOutputFile(state);
+}
+
+// Parses p and q and reads the private key, making sure they can be used
+// together. Returns 1 (having printed out why) if they can't.
+int readKey(run_state_t &state, const std::string &pStr, const std::string &qStr, widest_t &p, widest_t &q) {
     DEBUG("parsing values p and q...");
-    if (!isInteger(pStr)) {
+    auto start = phaseStart();
+    if (!parseNumber(pStr, p)) {
         std::cout << "parameter '" << pStr << "' is invalid!\n";
         return 1;
     }
-    if (!isInteger(qStr)) {
+    if (!parseNumber(qStr, q)) {
         std::cout << "parameter '" << qStr << "' is invalid!\n";
         return 1;
     }
     DEBUG("OK\n");
 
     DEBUG("checking if p and q are relative prime...");
-    int p = atoi(pStr.c_str());
-    int q = atoi(qStr.c_str());
     if (relativelyPrime(p, q) == false) {
         std::cout << "values p and q are not relatively prime!\n";
         return 1;
     }
+    recordPhase(state, "p/q validation", start);
     DEBUG("OK\n");
 
-    int ret = readPrivateKey(arg["private-key"].as<std::string>());
+    int ret = readPrivateKey(state, arg["private-key"].as<std::string>());
     if (ret == 1)
         std::cout << "'" << arg["private-key"].as<std::string>() << "' doesn't exist!\n";
     else if (ret == 2)
         std::cout << "the private key file contains values that are not numbers!\n";
+    else if (ret == 3)
+        std::cout << "the private key file is empty!\n";
     if (ret != 0)
         return 1;
     
     DEBUG("making sure the private key is a super-increasing sequence and that q is greater than the sum of all the values of the private key...");
-    int sum = isSuperincreasing(privateKey);
-    if (sum == -1) {
+    start = phaseStart();
+    widest_t sum;
+    if (!isSuperincreasing(state.parsedPrivateKey, sum)) {
         std::cout << "the private key is not a super-increasing sequence!\n";
         return 1;
     }
@@ -411,10 +856,364 @@ int main(int argc, char *argv[]) {
         std::cout << "the sum of all the values (" << sum << ") is greater than q (" << q << ")!\n";
         return 1;
     }
+    recordPhase(state, "key parsing", start);
     DEBUG("OK\n");
+    return 0;
+}
+
+const std::string SUFFIX_DECRYPTED_FILE = ".decrypted";
+
+// The output of a file processed in the batch mode, put next to the file.
+// A container is called the same as by createBinaryOutputFile(), and the
+// data decrypted from it is called as the original file (the prefix of the
+// container, if any, being cut off) with a suffix, so it never replaces
+// the file it has been encrypted from.
+std::string getBatchOutputFileName(const std::string &fileName, bool decrypt) {
+    std::filesystem::path path(fileName);
+    std::string name = path.filename().string();
+    if (!decrypt)
+        return (path.parent_path() / (PREFIX_BIN_FILE + name)).string();
+    if (name.rfind(PREFIX_BIN_FILE, 0) == 0 && name.size() > PREFIX_BIN_FILE.size())
+        name = name.substr(PREFIX_BIN_FILE.size());
+    return (path.parent_path() / (name + SUFFIX_DECRYPTED_FILE)).string();
+}
+
+// Whether the file found in a directory is to be encrypted (or decrypted).
+// A container is told by its magic, although it may still be broken.
+bool isBatchInput(const std::string &fileName, bool decrypt) {
+    std::ifstream file(fileName, std::ios::binary);
+    container_header_t header;
+    bool container = !file.fail() && readContainerHeader(file, header) != 1;
+    if (decrypt)
+        return container;
+    size_t suffix = SUFFIX_DECRYPTED_FILE.size();
+    return !container && !(fileName.size() > suffix && fileName.compare(fileName.size() - suffix, suffix, SUFFIX_DECRYPTED_FILE) == 0);
+}
 
-    generatePublicKey(p, q);
-    encryptData();
-    decryptData(p, q);
+// Collects the files given, the files within the directories given (recursively)
+// and the files listed in --file-list (one per line). Only the containers are
+// taken from the directories when decrypting, while the outputs of an earlier
+// batch (the containers and the decrypted files) are left out when encrypting.
+// The largest files go first, so that none of them is started last. Returns 1
+// (having printed out why) if some of them don't exist.
+int collectBatchFiles(std::vector<std::string> inputs, bool decrypt, std::vector<std::string> &files) {
+    if (arg.count("file-list")) {
+        std::ifstream list(arg["file-list"].as<std::string>());
+        if (list.fail()) {
+            std::cout << "'" << arg["file-list"].as<std::string>() << "' doesn't exist!\n";
+            return 1;
+        }
+        std::string line;
+        while (std::getline(list, line)) {
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+            if (!line.empty())
+                inputs.push_back(line);
+        }
+    }
+    for (const std::string &input : inputs) {
+        std::error_code error;
+        if (std::filesystem::is_directory(input, error)) {
+            for (const auto &entry : std::filesystem::recursive_directory_iterator(input, error))
+                if (entry.is_regular_file() && isBatchInput(entry.path().string(), decrypt))
+                    files.push_back(entry.path().string());
+        } else if (std::filesystem::is_regular_file(input, error)) {
+            files.push_back(input);
+        } else {
+            std::cout << "'" << input << "' doesn't exist!\n";
+            return 1;
+        }
+    }
+    std::vector<std::pair<uintmax_t, std::string>> sized;
+    for (const std::string &file : files)
+        sized.push_back({std::filesystem::file_size(file), file});
+    std::stable_sort(sized.begin(), sized.end(), [](const auto &a, const auto &b) { return a.first > b.first; });
+    for (size_t i = 0; i < files.size(); i++)
+        files[i] = sized[i].second;
     return 0;
-}
\ No newline at end of file
+}
+
+// Encrypts the file into a container. Returns 0 on success, 1 if the file
+// couldn't be read and 2 if the container couldn't be written.
+int encryptFile(const KeyPair &key, const Encryptor &encryptor, const std::string &fileName, uint64_t &blocks) {
+    MappedFile data;
+    if (data.open(fileName, getIoBackend()) != 0)
+        return 1;
+    MappedFile container;
+    if (container.create(getBatchOutputFileName(fileName, false), CONTAINER_HEADER_SIZE + encryptor.maxEncryptedSize(data.size())) != 0)
+        return 2;
+    blocks = encryptor.encrypt(data.data(), data.size(), container.data() + CONTAINER_HEADER_SIZE);
+
+    auto header = makeContainerHeader(key, data.size() * 8);
+    header.blockCount = blocks;
+    storeContainerHeader(container.data(), header);
+    return container.truncate(CONTAINER_HEADER_SIZE + blocks * header.elementWidth) == 0 ? 0 : 2;
+}
+
+// Decrypts the container into the original data. Returns 0 on success, 1 if
+// the file couldn't be read, 2 if the output couldn't be written and 3 if the
+// file is not a container encrypted using the key.
+int decryptFile(const KeyPair &key, const Decryptor &decryptor, const std::string &fileName, uint64_t &blocks) {
+    MappedFile container;
+    if (container.open(fileName, getIoBackend()) != 0)
+        return 1;
+    container_header_t header;
+    if (loadContainerHeader(container.data(), container.size(), header) != 0 || header.keyLength != key.length() || header.elementWidth != key.elementWidth())
+        return 3;
+    blocks = header.blockCount;
+    // The last block is left out by the encryption when it is zero. Its bits
+    // are zero too, which the output file already is when it is created.
+    uint64_t decryptedBlocks = blocks;
+    if (blocks * header.keyLength < header.bitLength)
+        decryptedBlocks++;
+    MappedFile decrypted;
+    if (decrypted.create(getBatchOutputFileName(fileName, true), decryptor.maxDecryptedSize(decryptedBlocks)) != 0)
+        return 2;
+    decryptor.decrypt(container.data() + CONTAINER_HEADER_SIZE, blocks, decrypted.data());
+    blocks = decryptedBlocks;
+    size_t size = std::min(decryptedBlocks * header.keyLength / 8, header.bitLength / 8);
+    return decrypted.truncate(size) == 0 ? 0 : 2;
+}
+
+// Encrypts (or decrypts with --decrypt) each of the files. The files are tasks
+// of the pool, and the ranges of a large file are taken over by the threads
+// done with their own files. Returns 1 if some of the files have failed.
+int runBatch(run_state_t &state, const std::vector<std::string> &files) {
+    bool decrypt = arg["decrypt"].as<bool>();
+    state.threadPool = std::make_unique<ThreadPool>(arg["threads"].as<unsigned>());
+    auto start = phaseStart();
+    std::unique_ptr<Encryptor> encryptor;
+    std::unique_ptr<Decryptor> decryptor;
+    if (decrypt)
+        decryptor = std::make_unique<Decryptor>(state.key, arg["decode-table-limit"].as<size_t>(), getDecomposition(), state.threadPool.get());
+    else
+        encryptor = std::make_unique<Encryptor>(state.key, arg["encryption-table-limit"].as<size_t>(), state.threadPool.get());
+    recordPhase(state, decrypt ? "decryption" : "encryption", start);
+
+    DEBUG((decrypt ? "decrypting " : "encrypting "));
+    DEBUG(files.size());
+    DEBUG(" files...");
+    start = phaseStart();
+    std::mutex mutex; // guards the counters and the messages
+    uint64_t bytes = 0, blocks = 0;
+    size_t failed = 0;
+    std::vector<std::future<void>> futures;
+    for (const std::string &file : files) {
+        futures.push_back(state.threadPool->submit([&, file] {
+            uint64_t fileBlocks = 0;
+            int ret = decrypt ? decryptFile(state.key, *decryptor, file, fileBlocks) : encryptFile(state.key, *encryptor, file, fileBlocks);
+            std::lock_guard<std::mutex> lock(mutex);
+            if (ret == 1)
+                std::cout << "'" << file << "' couldn't be read!\n";
+            else if (ret == 2)
+                std::cout << "'" << getBatchOutputFileName(file, decrypt) << "' couldn't be written!\n";
+            else if (ret == 3)
+                std::cout << "'" << file << "' is not a valid container!\n";
+            if (ret != 0) {
+                failed++;
+                return;
+            }
+            bytes += std::filesystem::file_size(file);
+            blocks += fileBlocks;
+        }));
+    }
+    for (auto &future : futures)
+        future.get();
+    recordPhase(state, decrypt ? "decryption" : "encryption", start, bytes, blocks);
+    DEBUG("OK (");
+    DEBUG(files.size() - failed);
+    DEBUG(" done, ");
+    DEBUG(failed);
+    DEBUG(" failed)\n");
+    return failed != 0 ? 1 : 0;
+}
+
+// Loads the key once for all the inputs of the batch mode:
+// ./knapsack <p> <q> --batch <input>... or ./knapsack --keyring <file> --batch <input>...
+int batch(run_state_t &state) {
+    std::vector<std::string> inputs = arg.unmatched();
+    bool useKeyring = arg.count("keyring");
+    size_t keyParameters = useKeyring ? 0 : 2;
+    if (inputs.size() < keyParameters || (inputs.size() == keyParameters && !arg.count("file-list"))) {
+        std::cout << "ERR: Compulsory parameters are not specified!\n";
+        std::cout << "     Run './knapsack --help'\n";
+        return 1;
+    }
+    if (useKeyring) {
+        if (readKeyring(state, arg["keyring"].as<std::string>(), state.key) != 0)
+            return 1;
+    } else {
+        widest_t p, q;
+        if (readKey(state, inputs[0], inputs[1], p, q) != 0)
+            return 1;
+        if (deriveKey(state, state.parsedPrivateKey, p, q) != 0) {
+            std::cout << "the value q is too large for a key of " << state.parsedPrivateKey.size() << " values!\n";
+            return 1;
+        }
+        writePublicKey(state);
+    }
+    std::vector<std::string> files;
+    if (collectBatchFiles(std::vector<std::string>(inputs.begin() + keyParameters, inputs.end()), arg["decrypt"].as<bool>(), files) != 0)
+        return 1;
+    int ret = runBatch(state, files);
+    if (ret == 0)
+        reportStats(state);
+    return ret;
+}
+
+// Set by SIGINT and SIGTERM to stop the server.
+std::atomic<bool> stopServer(false);
+
+void requestStop(int) {
+    stopServer = true;
+}
+
+// Loads the keyrings given and serves requests over the socket until
+// the process is interrupted, see server.hpp.
+int serveRequests(run_state_t &state, const std::vector<std::string> &keyringFiles) {
+    std::vector<KeyPair> keys(keyringFiles.size());
+    for (size_t i = 0; i < keys.size(); i++)
+        if (readKeyring(state, keyringFiles[i], keys[i]) != 0)
+            return 1;
+
+    struct sigaction action = {};
+    action.sa_handler = requestStop;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    std::string socketPath = arg["serve"].as<std::string>();
+    server_options_t serverOptions = {arg["threads"].as<unsigned>(), arg["encryption-table-limit"].as<size_t>(), arg["decode-table-limit"].as<size_t>(), getDecomposition()};
+    server_stats_t serverStats;
+    DEBUG("serving requests on '");
+    DEBUG(socketPath);
+    DEBUG("'...");
+    if (serve(socketPath, keys, serverOptions, stopServer, serverStats) != 0) {
+        std::cout << "the socket '" << socketPath << "' couldn't be created!\n";
+        return 1;
+    }
+    DEBUG("OK\n");
+    if (arg["stats"].as<bool>()) {
+        printLatencyTable(std::cout, "encryption", serverStats.encryption);
+        printLatencyTable(std::cout, "decryption", serverStats.decryption);
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    options.add_options()
+        ("v,verbose", "print out info as the program proceeds", cxxopts::value<bool>()->default_value("false"))
+        ("o,output", "name of the output file", cxxopts::value<std::string>()->default_value("output.txt"))
+        ("b,binary", "the input file will be treated as a binary file", cxxopts::value<bool>()->default_value("false"))
+        ("k,private-key", "file containing the private key", cxxopts::value<std::string>()->default_value("keys/private_key_1.txt"))
+        ("l,public-key", "file containing the private key", cxxopts::value<std::string>()->default_value("public_key.txt"))
+        ("p,print", "print out the binary data as well as the decrypted text", cxxopts::value<bool>()->default_value("false"))
+        ("d,debug", "print out step-by-step the process of encryption/decryption", cxxopts::value<bool>()->default_value("false"))
+        ("t,threads", "number of threads used for encryption/decryption (0 = all cores)", cxxopts::value<unsigned>()->default_value("1"))
+        ("s,stream", "process the input in chunks instead of loading it into memory as a whole", cxxopts::value<bool>()->default_value("false"))
+        ("buffer-size", "size of the chunks (in bytes) the input is read in when streaming", cxxopts::value<size_t>()->default_value("4194304"))
+        ("io", "how the input and output files are read and written (uring = io_uring if the kernel supports it, blocking otherwise, or blocking)", cxxopts::value<std::string>()->default_value("uring"))
+        ("f,format", "format of the encrypted data (hex or binary)", cxxopts::value<std::string>()->default_value("hex"))
+        ("c,container", "file the encrypted data is written to in the binary format", cxxopts::value<std::string>()->default_value("encrypted.knap"))
+        ("encryption-table-limit", "max size (in bytes) of the tables used to encrypt a byte at a time (0 = no tables)", cxxopts::value<size_t>()->default_value("16777216"))
+        ("decode-table-limit", "max size (in bytes) of the table used to decrypt blocks by a lookup (0 = no table)", cxxopts::value<size_t>()->default_value("16777216"))
+        ("decomposition", "how the blocks are decomposed into the private key (linear, jump or auto)", cxxopts::value<std::string>()->default_value("auto"))
+        ("decrypt", "the input file is a container (binary format) or an output file (hex format) to be decrypted", cxxopts::value<bool>()->default_value("false"))
+        ("stats", "print out the time spent in each phase along with the amount of data processed", cxxopts::value<bool>()->default_value("false"))
+        ("stats-file", "file the time spent in each phase is written to (JSON)", cxxopts::value<std::string>())
+        ("keygen", "generate a random private key of the given length along with p and q (the private key is written into -k, private_key.txt by default)", cxxopts::value<size_t>())
+        ("seed", "seed of the random numbers used by --keygen", cxxopts::value<uint64_t>())
+        ("create-keyring", "validate the private key, p and q and write them along with everything derived from them into a keyring (./knapsack <p> <q> --create-keyring <file>)", cxxopts::value<std::string>())
+        ("keyring", "keyring used instead of the private key, p and q (./knapsack <input> --keyring <file>)", cxxopts::value<std::string>())
+        ("batch", "encrypt (or decrypt using --decrypt) each of the files and directories given into knapsack_<name> (or <name>.decrypted) next to it (./knapsack <p> <q> --batch <input>...)", cxxopts::value<bool>()->default_value("false"))
+        ("file-list", "file listing the inputs of --batch, one per line", cxxopts::value<std::string>())
+        ("serve", "serve encrypt/decrypt requests over the given Unix socket using the keyrings given (./knapsack --serve <socket> <keyring>...)", cxxopts::value<std::string>())
+        ("skip-keyring-checksum", "don't verify the checksum of the keyring", cxxopts::value<bool>()->default_value("false"))
+        ("x,hex-padding", "set number of digits to be printed out in a hexadecimal format", cxxopts::value<uint8_t>()->default_value("5"))
+        ("h,help", "print help")
+    ;
+    arg = options.parse(argc, argv);
+    run_state_t state;
+    if (arg.count("help")) {
+        std::cout << options.help() << std::endl;
+        return 0;
+    }
+    if (arg.count("keygen")) {
+        int ret = generateKeys(state, arg["keygen"].as<size_t>());
+        if (ret == 0)
+            reportStats(state);
+        return ret;
+    }
+    std::string decomposition = arg["decomposition"].as<std::string>();
+    if (decomposition != "linear" && decomposition != "jump" && decomposition != "auto") {
+        std::cout << "decomposition '" << decomposition << "' is not supported!\n";
+        return 1;
+    }
+    if (arg["batch"].as<bool>())
+        return batch(state);
+    if (arg.count("serve")) {
+        if (arg.unmatched().empty()) {
+            std::cout << "ERR: Compulsory parameters are not specified!\n";
+            std::cout << "     Run './knapsack --help'\n";
+            return 1;
+        }
+        return serveRequests(state, arg.unmatched());
+    }
+    // the keyring replaces p and q, and it is created without any input
+    bool createKeyring = arg.count("create-keyring");
+    bool useKeyring = arg.count("keyring");
+    if (argc < (createKeyring ? 3 : useKeyring ? 2 : 4)) {
+        std::cout << "ERR: Compulsory parameters are not specified!\n";
+        std::cout << "     Run './knapsack --help'\n";
+        return 1;
+    }    
+    state.inputFileName = createKeyring ? "" : argv[1];
+    std::string pStr = useKeyring ? "" : argv[createKeyring ? 1 : 2];
+    std::string qStr = useKeyring ? "" : argv[createKeyring ? 2 : 3];
+    int ret;
+
+    if (arg["format"].as<std::string>() != "hex" && arg["format"].as<std::string>() != "binary") {
+        std::cout << "format '" << arg["format"].as<std::string>() << "' is not supported!\n";
+        return 1;
+    }
+    if (arg["io"].as<std::string>() != "uring" && arg["io"].as<std::string>() != "blocking") {
+        std::cout << "I/O backend '" << arg["io"].as<std::string>() << "' is not supported!\n";
+        return 1;
+    }
+    if (createKeyring) {
+        // there is no input
+    } else if (arg["decrypt"].as<bool>()) {
+        // anything but a container is taken for an output file in the hex
+        // format, which can be parsed only once the key is known
+        ret = readContainerFile(state, state.inputFileName);
+        if (ret == 1 || ret == 3) {
+            std::cout << (ret == 1 ? "input file not found!\n" : "the input file is not a valid container!\n");
+            return 1;
+        }
+        state.hexInput = ret == 2;
+    } else if (arg["stream"].as<bool>() && !std::ifstream(state.inputFileName).fail()) {
+        // the input will be read in chunks later on
+    } else if (readInputFile(state, state.inputFileName) != 0) {
+        std::cout << "input file not found!\n";
+        return 1;
+    }
+    widest_t p, q;
+    if (useKeyring) {
+        if (readKeyring(state, arg["keyring"].as<std::string>(), state.key) != 0)
+            return 1;
+    } else if (readKey(state, pStr, qStr, p, q) != 0) {
+        return 1;
+    }
+    size_t n = useKeyring ? state.key.length() : state.parsedPrivateKey.size();
+    if (arg["decrypt"].as<bool>() && !state.hexInput && state.containerHeader.keyLength != n) {
+        std::cout << "the data has been encrypted using a key of a different length!\n";
+        return 1;
+    }
+    if (!useKeyring && deriveKey(state, state.parsedPrivateKey, p, q) != 0) {
+        std::cout << "the value q is too large for a key of " << n << " values!\n";
+        return 1;
+    }
+    ret = createKeyring ? createKeyringFile(state) : run(state);
+    if (ret == 0)
+        reportStats(state);
+    return ret;
+}
@@ -0,0 +1,110 @@
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "output.hpp"
+#include "hex.hpp"
+
+OutputWriter::OutputWriter(int fd, size_t bufferSize) : fd(fd), buffer(std::max(bufferSize, MAX_HEX_LENGTH)) {
+}
+
+OutputWriter::~OutputWriter() {
+    close();
+}
+
+int OutputWriter::open(const std::string &fileName) {
+    close();
+    fd = ::open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    owned = fd >= 0;
+    failed = false;
+    written = 0;
+    return fd >= 0 ? 0 : 1;
+}
+
+int OutputWriter::close() {
+    bool ok = flush();
+    if (owned) {
+        ok = ::close(fd) == 0 && ok;
+        fd = -1;
+        owned = false;
+    }
+    return ok ? 0 : 1;
+}
+
+bool OutputWriter::flush() {
+    return writeOut(nullptr, 0);
+}
+
+// Writes out the buffer followed by size bytes of data by as few calls as possible.
+bool OutputWriter::writeOut(const char *data, size_t size) {
+    iovec parts[2] = {{buffer.data(), used}, {(void *)data, size}};
+    written += used + size;
+    used = 0;
+    if (fd < 0)
+        return !failed;
+    iovec *part = parts;
+    int count = 2;
+    while (count > 0 && !failed) {
+        if (part->iov_len == 0) {
+            part++;
+            count--;
+            continue;
+        }
+        ssize_t done = writev(fd, part, count);
+        if (done < 0 && errno == EINTR)
+            continue;
+        if (done <= 0) {
+            failed = true;
+            break;
+        }
+        for (; count > 0 && (size_t)done >= part->iov_len; part++, count--)
+            done -= part->iov_len;
+        if (count > 0) {
+            part->iov_base = (char *)part->iov_base + done;
+            part->iov_len -= done;
+        }
+    }
+    return !failed;
+}
+
+char *OutputWriter::reserve(size_t size) {
+    if (used + size > buffer.size())
+        flush();
+    return &buffer[used];
+}
+
+void OutputWriter::write(const char *data, size_t size) {
+    // data filling half of the buffer is passed to writev() as it is
+    if (size >= buffer.size() / 2) {
+        writeOut(data, size);
+        return;
+    }
+    memcpy(reserve(size), data, size);
+    used += size;
+}
+
+void OutputWriter::write(const std::string &text) {
+    write(text.data(), text.size());
+}
+
+void OutputWriter::put(char c) {
+    *reserve(1) = c;
+    used++;
+}
+
+void OutputWriter::writeData(const uint8_t *data, size_t size, bool binary, int hexPadding) {
+    if (!binary) {
+        write((const char *)data, size);
+        return;
+    }
+    for (size_t i = 0; i < size; i++)
+        used += formatHex(reserve(MAX_HEX_LENGTH), &data[i], 1, hexPadding);
+}
+
+void OutputWriter::writeBlocks(const uint8_t *blocks, size_t count, uint8_t width, int hexPadding) {
+    for (size_t i = 0; i < count; i++)
+        used += formatHex(reserve(MAX_HEX_LENGTH), &blocks[i * width], width, hexPadding);
+}
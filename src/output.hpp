@@ -0,0 +1,62 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+const size_t OUTPUT_BUFFER_SIZE = 1 << 20;
+
+// Writes into a file through a buffer of its own, which the data is formatted
+// straight into (see hex.hpp). The buffer is written out by
+// writev() once it is full, along with the raw data too large to be worth
+// copying into it.
+class OutputWriter {
+public:
+    // The writer writes into fd (which is left open), or into nothing until
+    // a file is opened.
+    explicit OutputWriter(int fd = -1, size_t bufferSize = OUTPUT_BUFFER_SIZE);
+    ~OutputWriter();
+
+    OutputWriter(const OutputWriter &) = delete;
+    OutputWriter &operator=(const OutputWriter &) = delete;
+
+    // Creates (or replaces) the file written into from now on. Returns 0 on
+    // success, 1 if the file couldn't be created.
+    int open(const std::string &fileName);
+
+    // Writes out the buffer and closes the file opened by open(). Returns 0 on
+    // success, 1 if some of the output couldn't be written.
+    int close();
+
+    // Writes out the buffer. Returns false if it couldn't be written.
+    bool flush();
+
+    void write(const char *data, size_t size);
+    void write(const std::string &text);
+    void put(char c);
+
+    // Writes the data either as hexadecimal numbers padded to hexPadding
+    // digits and separated by spaces, or as characters.
+    void writeData(const uint8_t *data, size_t size, bool binary, int hexPadding);
+    // The same as writeData() in the hexadecimal format, except the data are
+    // count little-endian numbers of width bytes each (see container.hpp).
+    void writeBlocks(const uint8_t *blocks, size_t count, uint8_t width, int hexPadding);
+
+    // The number of bytes written so far, including those in the buffer.
+    uint64_t position() const {
+        return written + used;
+    }
+
+private:
+    // Returns where the next size bytes go, writing out the buffer if they don't fit.
+    char *reserve(size_t size);
+    bool writeOut(const char *data, size_t size);
+
+    int fd;
+    bool owned = false;
+    bool failed = false;
+    std::vector<char> buffer;
+    size_t used = 0;
+    uint64_t written = 0;
+};
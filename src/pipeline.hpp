@@ -0,0 +1,173 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cstdint>
+
+// Waits a little before the next attempt of a spinning thread: yields at
+// first, then sleeps so that a stage waiting for a slower one doesn't keep
+// a core busy.
+inline void backOff(unsigned attempt) {
+    if (attempt < 64)
+        std::this_thread::yield();
+    else
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+}
+
+// A bounded queue any number of threads can push into and pop from at once
+// without a lock. Each cell has a sequence number telling whether it is
+// the turn of a push or of a pop (D. Vyukov's MPMC queue). The capacity is
+// rounded up to a power of two.
+template<typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : cells(roundUp(capacity)), mask(cells.size() - 1) {
+        for (size_t i = 0; i < cells.size(); i++)
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    BoundedQueue(const BoundedQueue &) = delete;
+    BoundedQueue &operator=(const BoundedQueue &) = delete;
+
+    // Returns false if the queue is full.
+    bool tryPush(T &value) {
+        size_t position = tail.load(std::memory_order_relaxed);
+        while (true) {
+            cell_t &cell = cells[position & mask];
+            intptr_t difference = (intptr_t)cell.sequence.load(std::memory_order_acquire) - (intptr_t)position;
+            if (difference < 0)
+                return false;
+            if (difference > 0)
+                position = tail.load(std::memory_order_relaxed);
+            else if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                cell.value = std::move(value);
+                cell.sequence.store(position + 1, std::memory_order_release);
+                return true;
+            }
+        }
+    }
+
+    // Returns false if the queue is empty.
+    bool tryPop(T &value) {
+        size_t position = head.load(std::memory_order_relaxed);
+        while (true) {
+            cell_t &cell = cells[position & mask];
+            intptr_t difference = (intptr_t)cell.sequence.load(std::memory_order_acquire) - (intptr_t)(position + 1);
+            if (difference < 0)
+                return false;
+            if (difference > 0)
+                position = head.load(std::memory_order_relaxed);
+            else if (head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                value = std::move(cell.value);
+                cell.sequence.store(position + mask + 1, std::memory_order_release);
+                return true;
+            }
+        }
+    }
+
+    void push(T value) {
+        for (unsigned attempt = 0; !tryPush(value); attempt++)
+            backOff(attempt);
+    }
+
+    // Waits for a value. Returns false once the queue has been closed and
+    // there is nothing left in it.
+    bool pop(T &value) {
+        for (unsigned attempt = 0; ; attempt++) {
+            if (tryPop(value))
+                return true;
+            if (closed.load(std::memory_order_acquire))
+                return tryPop(value);
+            backOff(attempt);
+        }
+    }
+
+    // To be called once nothing is going to be pushed anymore.
+    void close() {
+        closed.store(true, std::memory_order_release);
+    }
+
+private:
+    struct cell_t {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    static size_t roundUp(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity)
+            size *= 2;
+        return size;
+    }
+
+    std::vector<cell_t> cells;
+    const size_t mask;
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+    std::atomic<bool> closed{false};
+};
+
+// Passes chunks of type C through three stages running at the same time:
+// read(C &) fills a chunk on a thread of its own until it returns false,
+// process(C &) is run by the given number of worker threads and write(C &)
+// by the calling thread, in the order the chunks have been read in.
+//
+// Only workers + 2 chunks are ever made, each of them going round and
+// round through the stages, so the buffers they hold are allocated once.
+template<typename C, typename R, typename P, typename W>
+void runPipeline(size_t workers, R read, P process, W write) {
+    struct slot_t {
+        C chunk;
+        uint64_t sequence;
+    };
+    workers = std::max(workers, (size_t)1);
+    size_t count = workers + 2;
+    std::vector<slot_t> slots(count);
+    BoundedQueue<slot_t *> empty(count), filled(count), processed(count);
+    for (slot_t &slot : slots)
+        empty.push(&slot);
+
+    std::thread reader([&] {
+        slot_t *slot;
+        for (uint64_t sequence = 0; empty.pop(slot) && read(slot->chunk); sequence++) {
+            slot->sequence = sequence;
+            filled.push(slot);
+        }
+        filled.close();
+    });
+
+    std::atomic<size_t> running(workers);
+    std::vector<std::thread> processors;
+    for (size_t i = 0; i < workers; i++) {
+        processors.emplace_back([&] {
+            slot_t *slot;
+            while (filled.pop(slot)) {
+                process(slot->chunk);
+                processed.push(slot);
+            }
+            if (--running == 0)
+                processed.close();
+        });
+    }
+
+    // the chunks in flight are less than count apart, so they can be put
+    // back in order by their sequence numbers modulo count
+    std::vector<slot_t *> pending(count, nullptr);
+    uint64_t next = 0;
+    slot_t *slot;
+    while (processed.pop(slot)) {
+        pending[slot->sequence % count] = slot;
+        while ((slot = pending[next % count]) != nullptr) {
+            write(slot->chunk);
+            pending[next % count] = nullptr;
+            next++;
+            empty.push(slot);
+        }
+    }
+    reader.join();
+    for (std::thread &processor : processors)
+        processor.join();
+}
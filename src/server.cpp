@@ -0,0 +1,302 @@
+#include <sstream>
+#include <algorithm>
+#include <mutex>
+#include <map>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "server.hpp"
+#include "container.hpp"
+#include "thread_pool.hpp"
+
+// How often (in milliseconds) the polling loop checks whether to stop.
+static const int STOP_CHECK_INTERVAL = 100;
+
+// The keys along with the tables built for them once for all the requests.
+struct server_keys_t {
+    const std::vector<KeyPair> &keys;
+    std::vector<Encryptor> encryptors;
+    std::vector<Decryptor> decryptors;
+};
+
+static void storeResponseHeader(uint8_t *dst, uint8_t status, uint8_t elementWidth, uint64_t blockCount, uint64_t size) {
+    dst[0] = status;
+    dst[1] = elementWidth;
+    storeLittleEndian(&dst[2], blockCount, 8);
+    storeLittleEndian(&dst[10], size, 8);
+}
+
+// A response made of the header only.
+static std::vector<uint8_t> makeResponse(uint8_t status) {
+    std::vector<uint8_t> response(RESPONSE_HEADER_SIZE);
+    storeResponseHeader(response.data(), status, 0, 0, 0);
+    return response;
+}
+
+// The payloads of the responses are written right after the room left for the header.
+static std::vector<uint8_t> encryptPayload(const server_keys_t &keys, uint32_t index, const uint8_t *payload, size_t size) {
+    const Encryptor &encryptor = keys.encryptors[index];
+    std::vector<uint8_t> response(RESPONSE_HEADER_SIZE + encryptor.maxEncryptedSize(size));
+    size_t count = encryptor.encrypt(payload, size, &response[RESPONSE_HEADER_SIZE]);
+    uint8_t width = keys.keys[index].elementWidth();
+    storeResponseHeader(response.data(), STATUS_OK, width, count, count * width);
+    response.resize(RESPONSE_HEADER_SIZE + count * width);
+    return response;
+}
+
+// The request is the header followed by the blocks, there is room for one more.
+static std::vector<uint8_t> decryptPayload(const server_keys_t &keys, uint32_t index, uint64_t bitLength, std::vector<uint8_t> &request) {
+    const KeyPair &key = keys.keys[index];
+    uint8_t width = key.elementWidth();
+    size_t size = request.size() - REQUEST_HEADER_SIZE;
+    if (size % width != 0)
+        return makeResponse(STATUS_INVALID_REQUEST);
+    uint64_t count = size / width;
+    // the last block is left out by the encryption when it is zero
+    if (count * key.length() < bitLength) {
+        if (bitLength > (count + 1) * key.length())
+            return makeResponse(STATUS_INVALID_REQUEST);
+        request.resize(request.size() + width, 0);
+        count++;
+    }
+    const Decryptor &decryptor = keys.decryptors[index];
+    std::vector<uint8_t> response(RESPONSE_HEADER_SIZE + decryptor.maxDecryptedSize(count));
+    size_t decrypted = decryptor.decrypt(&request[REQUEST_HEADER_SIZE], count, &response[RESPONSE_HEADER_SIZE]);
+    if (bitLength != 0)
+        decrypted = std::min(decrypted, (size_t)(bitLength / 8));
+    storeResponseHeader(response.data(), STATUS_OK, width, count, decrypted);
+    response.resize(RESPONSE_HEADER_SIZE + decrypted);
+    return response;
+}
+
+// Processes a request (the header followed by the payload) read in whole and
+// returns the response. Only the encryption and the decryption of a valid
+// request count towards the latencies.
+static std::vector<uint8_t> processRequest(const server_keys_t &keys, server_stats_t &stats, std::vector<uint8_t> &request) {
+    uint8_t operation = request[0];
+    uint32_t index = loadLittleEndian<uint32_t>(&request[1], 4);
+    uint64_t bitLength = loadLittleEndian<uint64_t>(&request[5], 8);
+    if (operation == OPERATION_STATS) {
+        std::ostringstream stream;
+        printLatencyTable(stream, "encryption", stats.encryption);
+        printLatencyTable(stream, "decryption", stats.decryption);
+        std::string text = stream.str();
+        std::vector<uint8_t> response(RESPONSE_HEADER_SIZE + text.size());
+        storeResponseHeader(response.data(), STATUS_OK, 0, 0, text.size());
+        memcpy(&response[RESPONSE_HEADER_SIZE], text.data(), text.size());
+        return response;
+    }
+    if (operation != OPERATION_ENCRYPT && operation != OPERATION_DECRYPT)
+        return makeResponse(STATUS_INVALID_REQUEST);
+    if (index >= keys.keys.size())
+        return makeResponse(STATUS_UNKNOWN_KEY);
+
+    auto start = phaseStart();
+    std::vector<uint8_t> response;
+    if (operation == OPERATION_ENCRYPT)
+        response = encryptPayload(keys, index, &request[REQUEST_HEADER_SIZE], request.size() - REQUEST_HEADER_SIZE);
+    else
+        response = decryptPayload(keys, index, bitLength, request);
+    if (response[0] == STATUS_OK)
+        addLatency(operation == OPERATION_ENCRYPT ? stats.encryption : stats.decryption, start);
+    return response;
+}
+
+// A connection is read from and written to without blocking by the polling
+// loop. Once a request has been read in whole, it is processed by the pool
+// and the connection isn't read from until its response has been sent, so
+// the requests of a connection are answered in order.
+struct connection_t {
+    std::vector<uint8_t> request;  // the header and the payload read so far
+    size_t received = 0;
+    std::vector<uint8_t> response; // being sent
+    size_t sent = 0;
+    bool busy = false;    // the request is being processed by the pool
+    bool closing = false; // closed once the response has been sent
+};
+
+// Reads as much of the request as there is. Returns false if the connection
+// has been closed (or broken).
+static bool receiveRequest(int fd, connection_t &connection) {
+    while (true) {
+        if (connection.request.size() < REQUEST_HEADER_SIZE)
+            connection.request.resize(REQUEST_HEADER_SIZE);
+        ssize_t received = recv(fd, &connection.request[connection.received], connection.request.size() - connection.received, 0);
+        if (received < 0 && errno == EINTR)
+            continue;
+        if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return true;
+        if (received <= 0)
+            return false;
+        connection.received += received;
+        if (connection.received < connection.request.size())
+            continue;
+        if (connection.request.size() > REQUEST_HEADER_SIZE)
+            return true; // the payload is complete
+        uint64_t size = loadLittleEndian<uint64_t>(&connection.request[13], 8);
+        if (size > MAX_REQUEST_PAYLOAD) {
+            // the payload isn't read, so the connection can't go on
+            connection.response = makeResponse(STATUS_INVALID_REQUEST);
+            connection.closing = true;
+            return true;
+        }
+        if (size == 0)
+            return true;
+        connection.request.resize(REQUEST_HEADER_SIZE + size);
+    }
+}
+
+static bool isRequestComplete(const connection_t &connection) {
+    return connection.received >= REQUEST_HEADER_SIZE && connection.received == connection.request.size() && !connection.closing;
+}
+
+// Sends as much of the response as the socket takes. Returns false if the
+// connection is broken.
+static bool sendResponse(int fd, connection_t &connection) {
+    while (connection.sent < connection.response.size()) {
+        ssize_t sent = send(fd, &connection.response[connection.sent], connection.response.size() - connection.sent, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return true;
+        if (sent <= 0)
+            return false;
+        connection.sent += sent;
+    }
+    connection.response.clear();
+    connection.sent = 0;
+    return true;
+}
+
+// Returns the listening socket, -1 if it couldn't be created. A socket left
+// behind by a server that hasn't stopped properly is replaced.
+static int listenOn(const std::string &socketPath) {
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path))
+        return -1;
+    memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+
+    struct stat status;
+    if (stat(socketPath.c_str(), &status) == 0 && S_ISSOCK(status.st_mode))
+        unlink(socketPath.c_str());
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    if (bind(fd, (const sockaddr *)&address, sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int serve(const std::string &socketPath, const std::vector<KeyPair> &keys, const server_options_t &options, const std::atomic<bool> &stop, server_stats_t &stats) {
+    int listener = listenOn(socketPath);
+    if (listener < 0)
+        return 1;
+    // the workers wake up the polling loop through the pipe once they are done
+    int wakeup[2];
+    if (pipe2(wakeup, O_NONBLOCK | O_CLOEXEC) != 0) {
+        close(listener);
+        unlink(socketPath.c_str());
+        return 1;
+    }
+
+    // every request is processed by a single thread, the requests are processed in parallel
+    server_keys_t serverKeys = {keys, {}, {}};
+    for (const KeyPair &key : keys) {
+        serverKeys.encryptors.emplace_back(key, options.encryptionTableLimit);
+        serverKeys.decryptors.emplace_back(key, options.decodeTableLimit, options.decomposition);
+    }
+
+    std::map<int, connection_t> connections;
+    std::mutex mutex;
+    std::vector<std::pair<int, std::vector<uint8_t>>> done; // the responses made by the workers
+    {
+        ThreadPool pool(options.threads);
+        std::vector<pollfd> polled;
+        while (!stop) {
+            polled = {{wakeup[0], POLLIN, 0}, {listener, POLLIN, 0}};
+            // a connection isn't polled while its request is being processed
+            for (auto &[fd, connection] : connections)
+                if (!connection.busy)
+                    polled.push_back({fd, short(connection.response.empty() ? POLLIN : POLLOUT), 0});
+            if (poll(polled.data(), polled.size(), STOP_CHECK_INTERVAL) <= 0)
+                continue;
+
+            std::vector<int> broken;
+            if (polled[0].revents != 0) {
+                char buffer[256];
+                while (read(wakeup[0], buffer, sizeof(buffer)) > 0)
+                    ;
+                std::lock_guard<std::mutex> lock(mutex);
+                for (auto &[fd, response] : done) {
+                    connection_t &connection = connections[fd];
+                    connection.busy = false;
+                    connection.response = std::move(response);
+                    if (!sendResponse(fd, connection))
+                        broken.push_back(fd);
+                }
+                done.clear();
+            }
+            for (size_t i = 2; i < polled.size(); i++) {
+                int fd = polled[i].fd;
+                connection_t &connection = connections[fd];
+                if (polled[i].revents == 0)
+                    continue;
+                bool ok = (polled[i].revents & POLLOUT) ? sendResponse(fd, connection) : receiveRequest(fd, connection);
+                if (!ok || (connection.closing && connection.response.empty())) {
+                    broken.push_back(fd);
+                } else if (isRequestComplete(connection)) {
+                    connection.busy = true;
+                    connection.received = 0;
+                    pool.submit([fd, request = std::move(connection.request), &serverKeys, &stats, &mutex, &done, &wakeup]() mutable {
+                        std::vector<uint8_t> response = processRequest(serverKeys, stats, request);
+                        {
+                            std::lock_guard<std::mutex> lock(mutex);
+                            done.emplace_back(fd, std::move(response));
+                        }
+                        char signal = 0;
+                        while (write(wakeup[1], &signal, 1) < 0 && errno == EINTR)
+                            ;
+                    });
+                    connection.request.clear();
+                }
+            }
+            for (int fd : broken) {
+                if (connections.count(fd) == 0 || connections[fd].busy)
+                    continue;
+                connections.erase(fd);
+                close(fd);
+            }
+
+            if (polled[1].revents != 0) {
+                int fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (fd >= 0)
+                    connections[fd];
+            }
+        }
+    }
+    // the requests being processed have been answered by now, so the
+    // connections are closed right after their responses
+    for (auto &[fd, response] : done) {
+        connection_t &connection = connections[fd];
+        connection.response = std::move(response);
+        pollfd writable = {fd, POLLOUT, 0};
+        while (sendResponse(fd, connection) && !connection.response.empty() && poll(&writable, 1, STOP_CHECK_INTERVAL) > 0)
+            ;
+    }
+    for (auto &[fd, connection] : connections)
+        close(fd);
+    close(wakeup[0]);
+    close(wakeup[1]);
+    close(listener);
+    unlink(socketPath.c_str());
+    return 0;
+}
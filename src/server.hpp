@@ -0,0 +1,57 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+#include "knapsack.hpp"
+#include "stats.hpp"
+
+// Requests served over a Unix domain socket by a long-running process that
+// loads the keys once. A client may send any number of requests over a
+// connection, each of them followed by a response. All the numbers are
+// little-endian.
+//
+//   request:  operation (1B) | key (4B) | bit length (8B) | payload size (8B) | payload
+//   response: status (1B) | element width (1B) | number of blocks (8B) | payload size (8B) | payload
+//
+// 'E' encrypts the payload with the key of the given index and responds with
+// the blocks (stored as in the container). 'D' decrypts the blocks of the
+// payload into the first bit length / 8 bytes of the original data (all the
+// whole bytes if the bit length is 0) and restores the last zero block left
+// out by the encryption. 'S' responds with the latency histograms as text.
+const size_t REQUEST_HEADER_SIZE = 21;
+const size_t RESPONSE_HEADER_SIZE = 18;
+const uint64_t MAX_REQUEST_PAYLOAD = (uint64_t)1 << 30;
+
+enum request_operation_t : uint8_t {
+    OPERATION_ENCRYPT = 'E',
+    OPERATION_DECRYPT = 'D',
+    OPERATION_STATS = 'S'
+};
+
+enum response_status_t : uint8_t {
+    STATUS_OK = 0,
+    STATUS_UNKNOWN_KEY = 1,     // there is no key of that index
+    STATUS_INVALID_REQUEST = 2  // unknown operation, too large or malformed payload
+};
+
+struct server_options_t {
+    size_t threads; // number of requests processed at a time (0 = all cores)
+    size_t encryptionTableLimit;
+    size_t decodeTableLimit;
+    decomposition_t decomposition;
+};
+
+// Time spent encrypting or decrypting the valid requests, per operation.
+struct server_stats_t {
+    latency_histogram_t encryption;
+    latency_histogram_t decryption;
+};
+
+// Serves the requests until stop is set, after which the connections are
+// shut down and the socket is removed. Returns 0 when stopped, 1 if the
+// socket couldn't be created.
+int serve(const std::string &socketPath, const std::vector<KeyPair> &keys, const server_options_t &options, const std::atomic<bool> &stop, server_stats_t &stats);
@@ -0,0 +1,89 @@
+#include <iomanip>
+#include <algorithm>
+
+#include "stats.hpp"
+#include "arithmetic.hpp"
+
+void addPhase(std::vector<phase_stats_t> &stats, const std::string &name, timestamp_t start, uint64_t bytes, uint64_t blocks) {
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for (auto &phase : stats) {
+        if (phase.name == name) {
+            phase.seconds += seconds;
+            phase.bytes += bytes;
+            phase.blocks += blocks;
+            return;
+        }
+    }
+    stats.push_back({name, seconds, bytes, blocks});
+}
+
+// MB (10^6 bytes) per second, 0 if the phase hasn't processed any bytes.
+static double throughput(const phase_stats_t &phase) {
+    return phase.bytes != 0 && phase.seconds > 0 ? phase.bytes / phase.seconds / 1e6 : 0;
+}
+
+void printStatsTable(std::ostream &stream, const std::vector<phase_stats_t> &stats) {
+    std::ios_base::fmtflags flags = stream.flags();
+    double total = 0;
+    stream << std::dec << std::setfill(' ') << std::fixed << std::setprecision(3);
+    stream << std::left << std::setw(24) << "phase" << std::right << std::setw(12) << "time [ms]"
+           << std::setw(14) << "bytes" << std::setw(12) << "blocks" << std::setw(12) << "MB/s" << "\n";
+    for (const auto &phase : stats) {
+        stream << std::left << std::setw(24) << phase.name << std::right << std::setw(12) << phase.seconds * 1e3
+               << std::setw(14) << phase.bytes << std::setw(12) << phase.blocks << std::setw(12) << throughput(phase) << "\n";
+        total += phase.seconds;
+    }
+    stream << std::left << std::setw(24) << "total" << std::right << std::setw(12) << total * 1e3 << "\n";
+    stream.flags(flags);
+}
+
+void writeStatsJson(std::ostream &stream, const std::vector<phase_stats_t> &stats) {
+    double total = 0;
+    stream << "{\n  \"phases\": [\n";
+    for (size_t i = 0; i < stats.size(); i++) {
+        const phase_stats_t &phase = stats[i];
+        stream << "    {\"phase\": \"" << phase.name << "\", \"seconds\": " << phase.seconds
+               << ", \"bytes\": " << phase.bytes << ", \"blocks\": " << phase.blocks
+               << ", \"mbPerSecond\": " << throughput(phase) << "}"
+               << (i + 1 < stats.size() ? ",\n" : "\n");
+        total += phase.seconds;
+    }
+    stream << "  ],\n  \"totalSeconds\": " << total << "\n}\n";
+}
+
+void addLatency(latency_histogram_t &histogram, timestamp_t start) {
+    uint64_t microseconds = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    histogram.buckets[std::min(bitLength(microseconds), (int)LATENCY_BUCKETS - 1)]++;
+    histogram.count++;
+    histogram.totalMicroseconds += microseconds;
+    uint64_t max = histogram.maxMicroseconds;
+    while (microseconds > max && !histogram.maxMicroseconds.compare_exchange_weak(max, microseconds))
+        ;
+}
+
+uint64_t getLatencyPercentile(const latency_histogram_t &histogram, double share) {
+    uint64_t count = histogram.count;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += histogram.buckets[i];
+        if (count != 0 && seen >= share * count)
+            return (uint64_t)1 << i;
+    }
+    return 0;
+}
+
+void printLatencyTable(std::ostream &stream, const std::string &name, const latency_histogram_t &histogram) {
+    std::ios_base::fmtflags flags = stream.flags();
+    uint64_t count = histogram.count;
+    stream << std::dec << std::setfill(' ') << std::fixed << std::setprecision(1);
+    stream << name << ": " << count << " requests, mean " << (count != 0 ? (double)histogram.totalMicroseconds / count : 0)
+           << " us, p50 < " << getLatencyPercentile(histogram, 0.5) << " us, p99 < " << getLatencyPercentile(histogram, 0.99)
+           << " us, max " << histogram.maxMicroseconds << " us\n";
+    for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+        if (histogram.buckets[i] == 0)
+            continue;
+        std::string range = "[" + std::to_string(i == 0 ? 0 : (uint64_t)1 << (i - 1)) + ", " + std::to_string((uint64_t)1 << i) + ") us";
+        stream << "  " << std::left << std::setw(24) << range << std::right << std::setw(12) << histogram.buckets[i] << "\n";
+    }
+    stream.flags(flags);
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <atomic>
+#include <ostream>
+#include <cstdint>
+
+typedef std::chrono::steady_clock::time_point timestamp_t;
+
+// Wall time spent in a phase of the run and the amount of data processed
+// by it. A phase done several times (e.g. once per chunk when streaming)
+// is summed up.
+struct phase_stats_t {
+    std::string name;
+    double seconds;
+    uint64_t bytes;
+    uint64_t blocks;
+};
+
+inline timestamp_t phaseStart() {
+    return std::chrono::steady_clock::now();
+}
+
+// Adds the time since start and the bytes and blocks to the phase. The
+// phases are kept in the order they have been added in for the first time.
+void addPhase(std::vector<phase_stats_t> &stats, const std::string &name, timestamp_t start, uint64_t bytes, uint64_t blocks);
+
+void printStatsTable(std::ostream &stream, const std::vector<phase_stats_t> &stats);
+void writeStatsJson(std::ostream &stream, const std::vector<phase_stats_t> &stats);
+
+const size_t LATENCY_BUCKETS = 32;
+
+// Latencies of requests counted in buckets of [2^(i-1), 2^i) microseconds,
+// bucket 0 being less than a microsecond. Several threads can add to it
+// at a time.
+struct latency_histogram_t {
+    std::atomic<uint64_t> buckets[LATENCY_BUCKETS] = {};
+    std::atomic<uint64_t> count = {0};
+    std::atomic<uint64_t> totalMicroseconds = {0};
+    std::atomic<uint64_t> maxMicroseconds = {0};
+};
+
+// Adds the time since start to the histogram.
+void addLatency(latency_histogram_t &histogram, timestamp_t start);
+
+// The upper bound (in microseconds) of the bucket the given share of the
+// latencies falls into, 0 if there are none.
+uint64_t getLatencyPercentile(const latency_histogram_t &histogram, double share);
+
+void printLatencyTable(std::ostream &stream, const std::string &name, const latency_histogram_t &histogram);
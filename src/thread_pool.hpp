@@ -0,0 +1,157 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+
+// A fixed number of worker threads, each with a queue of its own. A worker
+// takes the tasks of its own queue newest first and, once it runs out of
+// them, steals the oldest tasks of the other queues. Tasks submitted by
+// a worker go to its own queue, the rest are spread over the queues.
+//
+// parallelFor() can be called by the tasks themselves: a worker waiting
+// for its ranges runs the pending tasks in the meantime, so the ranges of
+// a large task are taken over by the workers done with their own.
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t threads) {
+        if (threads == 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        queues = std::vector<queue_t>(threads);
+        for (size_t i = 0; i < threads; i++)
+            workers.emplace_back([this, i] { work(i); });
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        cv.notify_all();
+        for (auto &worker : workers)
+            worker.join();
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    size_t size() const {
+        return workers.size();
+    }
+
+    template<typename F>
+    std::future<void> submit(F &&task) {
+        auto packaged = std::make_shared<std::packaged_task<void()>>(std::forward<F>(task));
+        auto future = packaged->get_future();
+        push([packaged] { (*packaged)(); });
+        return future;
+    }
+
+    // Splits [0, count) into ranges whose boundaries are multiples of
+    // alignment and runs task(begin, end) on each of them. Waits until
+    // all the ranges have been processed.
+    template<typename F>
+    void parallelFor(size_t count, size_t alignment, F task) {
+        size_t ranges = workers.size() * 4;
+        size_t rangeSize = (count + ranges - 1) / ranges;
+        rangeSize = std::max(alignment, (rangeSize + alignment - 1) / alignment * alignment);
+
+        std::atomic<size_t> pending((count + rangeSize - 1) / rangeSize);
+        std::mutex doneMutex;
+        std::condition_variable done;
+        for (size_t begin = 0; begin < count; begin += rangeSize) {
+            size_t end = std::min(count, begin + rangeSize);
+            push([&, begin, end] {
+                task(begin, end);
+                // the last range notifies while holding the lock, so the waiting
+                // thread can't return (and destroy the lock) before it is done
+                std::lock_guard<std::mutex> lock(doneMutex);
+                if (--pending == 0)
+                    done.notify_all();
+            });
+        }
+        // a worker can't just wait, as the ranges might be queued behind it
+        while (current == this && pending != 0 && runTask(index))
+            ;
+        std::unique_lock<std::mutex> lock(doneMutex);
+        done.wait(lock, [&] { return pending == 0; });
+    }
+
+private:
+    struct queue_t {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    void push(std::function<void()> task) {
+        size_t i = current == this ? index : next++ % queues.size();
+        {
+            std::lock_guard<std::mutex> lock(queues[i].mutex);
+            queues[i].tasks.push_back(std::move(task));
+            queued++;
+        }
+        // taking the lock makes sure a worker about to wait sees the task
+        { std::lock_guard<std::mutex> lock(mutex); }
+        cv.notify_one();
+    }
+
+    // Takes a task of the given queue (the newest) or another one (the oldest).
+    bool popTask(size_t i, std::function<void()> &task) {
+        for (size_t k = 0; k < queues.size(); k++) {
+            queue_t &queue = queues[(i + k) % queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.tasks.empty())
+                continue;
+            if (k == 0) {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+            } else {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+            }
+            queued--;
+            return true;
+        }
+        return false;
+    }
+
+    // Runs a pending task, returns false if there is none.
+    bool runTask(size_t i) {
+        std::function<void()> task;
+        if (!popTask(i, task))
+            return false;
+        task();
+        return true;
+    }
+
+    void work(size_t i) {
+        current = this;
+        index = i;
+        while (true) {
+            if (runTask(i))
+                continue;
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [this] { return stopping || queued != 0; });
+            if (stopping && queued == 0)
+                return;
+        }
+    }
+
+    // the pool (and the queue) of the worker the calling thread is, if any
+    static inline thread_local const ThreadPool *current = nullptr;
+    static inline thread_local size_t index = 0;
+
+    std::vector<std::thread> workers;
+    std::vector<queue_t> queues;
+    std::atomic<size_t> queued{0};
+    std::atomic<size_t> next{0};
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stopping = false;
+};